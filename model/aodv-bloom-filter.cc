@@ -0,0 +1,340 @@
+#include "aodv-bloom-filter.h"
+#include "aodv-id-cache.h"
+#include "ns3/test.h"
+#include <algorithm>
+#include <cmath>
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/// 64 bit finalizer of MurmurHash3
+static inline uint64_t
+Mix64 (uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+/**
+ * Bits for the i-th bit position of a key: each 64 bit hash drawn from seed yields seven
+ * independent 9 bit positions. Stepping one pair of hashes (a + i * b) instead correlates
+ * keys that share a stride and misses the false positive target.
+ */
+static inline uint64_t
+NextBits (uint32_t i, uint64_t & seed, uint64_t bits)
+{
+  if (i % 7 == 0)
+    return Mix64 (seed += 0x9e3779b97f4a7c15ULL);
+  return bits >> 9;
+}
+
+RotatingBloomFilter::RotatingBloomFilter (uint32_t memoryBudget, double falsePositiveRate, Time lifetime) :
+  m_memoryBudget (memoryBudget), m_falsePositiveRate (falsePositiveRate), m_lifetime (lifetime),
+  m_current (0), m_blocks (0), m_hashes (0), m_capacity (0), m_rotations (0)
+{
+  m_setBits[0] = m_setBits[1] = 0;
+  m_count[0] = m_count[1] = 0;
+}
+
+void
+RotatingBloomFilter::SetParameters (uint32_t memoryBudget, double falsePositiveRate)
+{
+  m_memoryBudget = memoryBudget;
+  m_falsePositiveRate = falsePositiveRate;
+  m_bits[0].clear ();
+  m_bits[1].clear ();
+  m_blocks = 0;
+  m_capacity = 0;
+  m_setBits[0] = m_setBits[1] = 0;
+  m_count[0] = m_count[1] = 0;
+}
+
+/**
+ * False positive rate of one block holding j keys and its second moment over the bit
+ * patterns, for all j up to the load where the block is practically saturated. Follows
+ * the distribution of set bits over the hashes of each key.
+ */
+static void
+GetBlockFalsePositiveRates (uint32_t blockBits, uint32_t hashes, std::vector<double> & rates, std::vector<double> & squares)
+{
+  std::vector<double> occupancy (blockBits + 1, 0);
+  std::vector<double> next (blockBits + 1, 0);
+  occupancy[0] = 1;
+  uint32_t lo = 0;
+  uint32_t hi = 0;
+  rates.assign (1, 0);
+  squares.assign (1, 0);
+  while (rates.back () < 1 - 1e-12 && rates.size () < 100000)
+    {
+      for (uint32_t i = 0; i < hashes; ++i)
+        {
+          uint32_t top = std::min (hi + 1, blockBits);
+          std::fill (next.begin () + lo, next.begin () + top + 1, 0);
+          for (uint32_t x = lo; x <= hi; ++x)
+            {
+              next[x] += occupancy[x] * x / blockBits;
+              if (x < blockBits)
+                next[x + 1] += occupancy[x] * (blockBits - x) / blockBits;
+            }
+          hi = top;
+          occupancy.swap (next);
+          // Drop negligible tails to keep the window small
+          while (occupancy[lo] < 1e-18 && lo < hi)
+            lo++;
+          while (occupancy[hi] < 1e-18 && hi > lo)
+            hi--;
+        }
+      double rate = 0;
+      double square = 0;
+      for (uint32_t x = lo; x <= hi; ++x)
+        {
+          double fp = std::pow (double (x) / blockBits, double (hashes));
+          rate += occupancy[x] * fp;
+          square += occupancy[x] * fp * fp;
+        }
+      rates.push_back (rate);
+      squares.push_back (square);
+    }
+}
+
+/**
+ * False positive rate of a blocked filter holding keys, plus three standard deviations of
+ * its spread between filters: block loads are Poisson and a lookup probes one random block.
+ */
+static double
+GetBlockedFalsePositiveBound (std::vector<double> const & rates, std::vector<double> const & squares,
+                              double keys, uint32_t blocks)
+{
+  double lambda = keys / blocks;
+  double weight = std::exp (-lambda);
+  double rate = 0;
+  double square = 0;
+  uint32_t last = (uint32_t) (lambda + 10 * std::sqrt (lambda) + 10);
+  for (uint32_t j = 0; j <= last; ++j)
+    {
+      rate += weight * (j < rates.size () ? rates[j] : 1);
+      square += weight * (j < squares.size () ? squares[j] : 1);
+      weight *= lambda / (j + 1);
+    }
+  return rate + 3 * std::sqrt (std::max (square - rate * rate, 0.0) / blocks);
+}
+
+void
+RotatingBloomFilter::Init ()
+{
+  m_blocks = std::max<uint32_t> (1, m_memoryBudget / 2 / (BLOCK_BITS / 8));
+  m_bits[0].assign (m_blocks * BLOCK_WORDS, 0);
+  m_bits[1].assign (m_blocks * BLOCK_WORDS, 0);
+  // Lookups hit both generations, so each of them gets half of the false positive budget
+  double p = std::min (std::max (m_falsePositiveRate / 2, 1e-9), 0.5);
+  m_hashes = std::min<uint32_t> (16, std::max<uint32_t> (1, (uint32_t) (-std::log (p) / std::log (2.0) + 0.5)));
+  // bits * ln2^2 / -ln p ignores the uneven load of blocks and overshoots the target, so
+  // take the largest capacity the blocked model allows. Keys found as false positives are
+  // not added, which leaves a full generation with the bits of capacity / (1 - p) keys.
+  std::vector<double> blockRates;
+  std::vector<double> blockSquares;
+  GetBlockFalsePositiveRates (BLOCK_BITS, m_hashes, blockRates, blockSquares);
+  uint32_t lo = 1;
+  uint32_t hi = m_blocks * BLOCK_BITS;
+  while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo + 1) / 2;
+      if (GetBlockedFalsePositiveBound (blockRates, blockSquares, mid / (1 - p), m_blocks) <= p)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+  m_capacity = lo;
+  m_started = Simulator::Now ();
+}
+
+bool
+RotatingBloomFilter::Contains (uint32_t gen, uint64_t key) const
+{
+  uint64_t h = Mix64 (key);
+  const uint64_t * block = &m_bits[gen][((h >> 32) % m_blocks) * BLOCK_WORDS];
+  uint64_t seed = h;
+  uint64_t bits = 0;
+  for (uint32_t i = 0; i < m_hashes; ++i)
+    {
+      bits = NextBits (i, seed, bits);
+      uint32_t bit = bits % BLOCK_BITS;
+      if (!(block[bit / 64] & (uint64_t (1) << (bit % 64))))
+        return false;
+    }
+  return true;
+}
+
+void
+RotatingBloomFilter::Add (uint32_t gen, uint64_t key)
+{
+  uint64_t h = Mix64 (key);
+  uint64_t * block = &m_bits[gen][((h >> 32) % m_blocks) * BLOCK_WORDS];
+  uint64_t seed = h;
+  uint64_t bits = 0;
+  for (uint32_t i = 0; i < m_hashes; ++i)
+    {
+      bits = NextBits (i, seed, bits);
+      uint32_t bit = bits % BLOCK_BITS;
+      uint64_t mask = uint64_t (1) << (bit % 64);
+      if (!(block[bit / 64] & mask))
+        {
+          block[bit / 64] |= mask;
+          m_setBits[gen]++;
+        }
+    }
+  m_count[gen]++;
+}
+
+void
+RotatingBloomFilter::Rotate ()
+{
+  m_current ^= 1;
+  std::fill (m_bits[m_current].begin (), m_bits[m_current].end (), 0);
+  m_setBits[m_current] = 0;
+  m_count[m_current] = 0;
+  m_started = Simulator::Now ();
+  m_rotations++;
+}
+
+bool
+RotatingBloomFilter::IsDuplicate (Ipv4Address addr, uint32_t id)
+{
+  if (m_blocks == 0)
+    Init ();
+  if (Simulator::Now () - m_started >= m_lifetime)
+    {
+      // Both generations are older than lifetime after two idle lifetimes
+      if (Simulator::Now () - m_started >= m_lifetime + m_lifetime)
+        Rotate ();
+      Rotate ();
+    }
+  uint64_t key = MakeKey (addr, id);
+  if (Contains (m_current, key) || Contains (m_current ^ 1, key))
+    return true;
+  if (m_count[m_current] >= m_capacity)
+    Rotate ();
+  Add (m_current, key);
+  return false;
+}
+
+bool
+RotatingBloomFilter::IsKnown (Ipv4Address addr, uint32_t id) const
+{
+  if (m_blocks == 0)
+    return false;
+  uint64_t key = MakeKey (addr, id);
+  return Contains (m_current, key) || Contains (m_current ^ 1, key);
+}
+
+double
+RotatingBloomFilter::GetFill () const
+{
+  if (m_blocks == 0)
+    return 0;
+  return double (m_setBits[m_current]) / (double (m_blocks) * BLOCK_BITS);
+}
+
+double
+RotatingBloomFilter::GetGenerationFalsePositiveRate (uint32_t gen) const
+{
+  if (m_blocks == 0)
+    return 0;
+  return std::pow (double (m_setBits[gen]) / (double (m_blocks) * BLOCK_BITS), double (m_hashes));
+}
+
+double
+RotatingBloomFilter::GetEstimatedFalsePositiveRate () const
+{
+  return 1 - (1 - GetGenerationFalsePositiveRate (0)) * (1 - GetGenerationFalsePositiveRate (1));
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for rotating Bloom filter, checked against exact IdCache
+struct RotatingBloomFilterTest : public TestCase
+{
+  RotatingBloomFilterTest () : TestCase ("Rotating Bloom filter"), filter (16384, 0.01, Seconds (10)), cache (Seconds (10))
+  {}
+  virtual void DoRun ();
+
+  RotatingBloomFilter filter;
+  IdCache cache;
+};
+
+void
+RotatingBloomFilterTest::DoRun ()
+{
+  NS_TEST_EXPECT_MSG_EQ (filter.GetCapacity (), 0, "Lazy allocation");
+  filter.IsDuplicate (Ipv4Address ("10.0.0.1"), 0);
+  cache.IsDuplicate (Ipv4Address ("10.0.0.1"), 0);
+  uint32_t n = filter.GetCapacity ();
+  NS_TEST_EXPECT_MSG_GT (n, 1000, "Capacity derived from memory budget");
+
+  // Same stream of fresh and repeated uids through both detectors, up to filter capacity
+  uint32_t fresh = 1;
+  uint32_t falsePositives = 0;
+  uint32_t falseNegatives = 0;
+  for (uint32_t i = 1; fresh < n; ++i)
+    {
+      uint32_t uid = (i % 4 == 0) ? i / 4 : fresh++;
+      Ipv4Address src (0x0a000000 + (uid % 50));
+      bool exact = cache.IsDuplicate (src, uid);
+      bool bloom = filter.IsDuplicate (src, uid);
+      if (bloom && !exact)
+        falsePositives++;
+      if (!bloom && exact)
+        falseNegatives++;
+    }
+  NS_TEST_EXPECT_MSG_EQ (falseNegatives, 0, "No false negative within capacity");
+  NS_TEST_EXPECT_MSG_EQ (filter.GetRotations (), 0, "Load within capacity");
+  NS_TEST_EXPECT_MSG_LT_OR_EQ (falsePositives, uint32_t (n * filter.GetFalsePositiveRate ()), "False positives while filling");
+
+  // Full generation: unknown uids must stay below the configured bound
+  falsePositives = 0;
+  uint32_t probes = 100 * n;
+  for (uint32_t uid = 0; uid < probes; ++uid)
+    if (filter.IsKnown (Ipv4Address (0x0b000000 + (uid % 50)), uid))
+      falsePositives++;
+  double rate = double (falsePositives) / probes;
+  NS_TEST_EXPECT_MSG_LT_OR_EQ (rate, filter.GetFalsePositiveRate (), "False positive bound");
+  NS_TEST_EXPECT_MSG_LT_OR_EQ (filter.GetEstimatedFalsePositiveRate (), filter.GetFalsePositiveRate (), "Estimated false positive rate");
+  NS_TEST_EXPECT_MSG_GT (filter.GetFill (), 0.3, "Fill");
+  NS_TEST_EXPECT_MSG_LT (filter.GetFill (), 0.7, "Fill");
+
+  // Going over capacity retires the oldest generation instead of growing
+  for (uint32_t uid = 0; uid < 3 * n; ++uid)
+    filter.IsDuplicate (Ipv4Address (0x0c000000 + (uid % 50)), uid);
+  NS_TEST_EXPECT_MSG_EQ (filter.GetRotations (), 3, "Rotation on capacity");
+  NS_TEST_EXPECT_MSG_EQ (filter.IsKnown (Ipv4Address (0x0c000000 + ((3 * n - 1) % 50)), 3 * n - 1), true, "Recent uid kept");
+
+  // Both generations full: lookups hit both, the union must stay below the configured bound
+  uint32_t rotations = filter.GetRotations ();
+  for (uint32_t uid = 0; filter.GetRotations () == rotations || filter.GetSize () < n; ++uid)
+    {
+      Ipv4Address src (0x0d000000 + (uid % 50));
+      cache.IsDuplicate (src, uid);
+      filter.IsDuplicate (src, uid);
+    }
+  NS_TEST_EXPECT_MSG_EQ (filter.GetRotations (), rotations + 1, "Previous generation kept full");
+  falsePositives = 0;
+  for (uint32_t uid = 0; uid < probes; ++uid)
+    {
+      Ipv4Address src (0x0e000000 + (uid % 50));
+      bool exact = cache.IsDuplicate (src, uid);
+      if (filter.IsKnown (src, uid) && !exact)
+        falsePositives++;
+    }
+  rate = double (falsePositives) / probes;
+  NS_TEST_EXPECT_MSG_LT_OR_EQ (rate, filter.GetFalsePositiveRate (), "False positive bound with both generations full");
+}
+//-----------------------------------------------------------------------------
+
+}
+}
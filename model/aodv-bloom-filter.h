@@ -0,0 +1,103 @@
+#ifndef __AODV_BLOOM_FILTER_H__
+#define __AODV_BLOOM_FILTER_H__
+
+#include "ns3/ipv4-address.h"
+#include "ns3/simulator.h"
+#include <vector>
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/**
+ * \ingroup aodv
+ *
+ * \brief Bounded memory, probabilistic counterpart of IdCache.
+ *
+ * Two blocked Bloom filters (one 512 bit cache line per key) are used as generations:
+ * keys are added to the current one and looked up in both. The current generation
+ * becomes the previous one (and the previous one is cleared) when it holds as many keys
+ * as its share of the memory budget allows for the requested false positive rate, or
+ * when it is older than the lifetime. A key is therefore remembered for at least one
+ * lifetime unless the load exceeds the filter capacity, and never reported as unknown
+ * before that. Bit arrays are allocated on first use.
+ */
+class RotatingBloomFilter
+{
+public:
+  /**
+   * c-tor
+   * \param memoryBudget bytes used by both generations together
+   * \param falsePositiveRate target probability that an unknown key is reported as duplicate
+   * \param lifetime age after which a generation is retired
+   */
+  RotatingBloomFilter (uint32_t memoryBudget, double falsePositiveRate, Time lifetime);
+  /// Check that (addr, id) was seen recently. Remember it, if it wasn't.
+  bool IsDuplicate (Ipv4Address addr, uint32_t id);
+  /// Check that (addr, id) was seen recently, without remembering it
+  bool IsKnown (Ipv4Address addr, uint32_t id) const;
+  /// Forget all keys and resize filters, takes effect on next insertion
+  void SetParameters (uint32_t memoryBudget, double falsePositiveRate);
+  uint32_t GetMemoryBudget () const { return m_memoryBudget; }
+  double GetFalsePositiveRate () const { return m_falsePositiveRate; }
+  void SetLifetime (Time lifetime) { m_lifetime = lifetime; }
+  Time GetLifetime () const { return m_lifetime; }
+  ///\name Counters
+  //\{
+  /// Number of keys each generation may hold before it is retired
+  uint32_t GetCapacity () const { return m_capacity; }
+  /// Number of keys added to the current generation
+  uint32_t GetSize () const { return m_count[m_current]; }
+  /// Fraction of bits set in the current generation
+  double GetFill () const;
+  /// False positive probability estimated from the fill of both generations
+  double GetEstimatedFalsePositiveRate () const;
+  /// Number of generation changes so far
+  uint32_t GetRotations () const { return m_rotations; }
+  //\}
+private:
+  /// Bits per block, one cache line
+  static const uint32_t BLOCK_BITS = 512;
+  /// 64 bit words per block
+  static const uint32_t BLOCK_WORDS = BLOCK_BITS / 64;
+  /// Allocate bit arrays and derive capacity and number of hash functions
+  void Init ();
+  /// Retire the previous generation, start a fresh current one
+  void Rotate ();
+  /// Key of (addr, id)
+  static uint64_t MakeKey (Ipv4Address addr, uint32_t id)
+  {
+    return (uint64_t (addr.Get ()) << 32) | id;
+  }
+  /// Check all k bits of key in generation gen
+  bool Contains (uint32_t gen, uint64_t key) const;
+  /// Set all k bits of key in generation gen
+  void Add (uint32_t gen, uint64_t key);
+  /// Fill of generation gen raised to the number of hash functions
+  double GetGenerationFalsePositiveRate (uint32_t gen) const;
+
+  uint32_t m_memoryBudget;
+  double m_falsePositiveRate;
+  Time m_lifetime;
+  /// Bit arrays of both generations
+  std::vector<uint64_t> m_bits[2];
+  /// Number of set bits per generation
+  uint32_t m_setBits[2];
+  /// Number of keys added per generation
+  uint32_t m_count[2];
+  /// Index of the current generation
+  uint32_t m_current;
+  /// Number of blocks per generation
+  uint32_t m_blocks;
+  /// Number of bits set per key
+  uint32_t m_hashes;
+  /// Keys per generation
+  uint32_t m_capacity;
+  /// When the current generation was started
+  Time m_started;
+  uint32_t m_rotations;
+};
+
+}
+}
+#endif /* __AODV_BLOOM_FILTER_H__ */
@@ -8,12 +8,15 @@ namespace aodvmesh
 bool
 DuplicatePacketDetection::IsDuplicate  (Ptr<const Packet> p, const Ipv4Header & header)
 {
+  if (m_mode == BLOOM)
+    return m_filter.IsDuplicate (header.GetSource (), p->GetUid ());
   return m_idCache.IsDuplicate (header.GetSource (), p->GetUid () );
 }
 void
 DuplicatePacketDetection::SetLifetime (Time lifetime)
 {
   m_idCache.SetLifetime (lifetime);
+  m_filter.SetLifetime (lifetime);
 }
 
 Time
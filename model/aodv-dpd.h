@@ -2,6 +2,7 @@
 #define __AODV_DUPLICATEPACKETDETECTION_H__
 
 #include "aodv-id-cache.h"
+#include "aodv-bloom-filter.h"
 #include "ns3/nstime.h"
 #include "ns3/packet.h"
 #include "ns3/ipv4-header.h"
@@ -17,21 +18,43 @@ namespace aodvmesh
  *
  * Currently duplicate detection is based on unique packet ID given by Packet::GetUid ()
  * This approach is known to be weak and should be changed.
+ *
+ * Two modes are available: EXACT remembers every (source, uid) for the whole lifetime,
+ * BLOOM bounds memory with a RotatingBloomFilter at the price of rare false positives.
  */
 class DuplicatePacketDetection
 {
 public:
+  /// Duplicate detection modes
+  enum Mode
+  {
+    EXACT = 0,  //!< IdCache, exact but unbounded
+    BLOOM = 1,  //!< Rotating Bloom filters, bounded memory
+  };
   /// C-tor
-  DuplicatePacketDetection (Time lifetime) : m_idCache (lifetime) {}
+  DuplicatePacketDetection (Time lifetime) : m_mode (EXACT), m_idCache (lifetime), m_filter (65536, 0.001, lifetime) {}
   /// Check that the packet is duplicated. If not, save information about this packet.
   bool IsDuplicate (Ptr<const Packet> p, const Ipv4Header & header);
   /// Set duplicate records lifetimes
   void SetLifetime (Time lifetime);
   /// Get duplicate records lifetimes
   Time GetLifetime () const;
+  ///\name Mode selection
+  //\{
+  void SetMode (Mode mode) { m_mode = mode; }
+  Mode GetMode () const { return m_mode; }
+  /// Set memory budget (bytes) and target false positive rate of BLOOM mode, forget seen packets
+  void SetFilterParameters (uint32_t memoryBudget, double falsePositiveRate) { m_filter.SetParameters (memoryBudget, falsePositiveRate); }
+  /// Access filter counters (fill, estimated false positive rate)
+  const RotatingBloomFilter & GetFilter () const { return m_filter; }
+  //\}
 private:
+  /// Active mode
+  Mode m_mode;
   /// Impl
   IdCache m_idCache;
+  /// Impl of BLOOM mode
+  RotatingBloomFilter m_filter;
 };
 
 }
@@ -0,0 +1,152 @@
+#ifndef __AODV_FLAT_HASH_H__
+#define __AODV_FLAT_HASH_H__
+
+#include <stdint.h>
+#include <vector>
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/**
+ * \ingroup aodv
+ *
+ * \brief Open addressing hash table with 64 bit integer keys.
+ *
+ * Linear probing over a single contiguous slot array, load factor kept below 1/2.
+ * Erase uses backward shift deletion, so there are no tombstones and lookups never
+ * degrade after long runs of insert/erase. Value pointers returned by Find () and
+ * Insert () are invalidated by any following Insert () or Erase ().
+ */
+template <typename V>
+class FlatHashMap
+{
+public:
+  /// c-tor
+  FlatHashMap () : m_size (0) {}
+  /// Return pointer to value stored for key, 0 if key is unknown
+  V * Find (uint64_t key)
+  {
+    if (m_size == 0)
+      return 0;
+    uint32_t mask = m_slots.size () - 1;
+    for (uint32_t i = Hash (key) & mask; m_slots[i].used; i = (i + 1) & mask)
+      if (m_slots[i].key == key)
+        return &m_slots[i].value;
+    return 0;
+  }
+  /// Const version of Find ()
+  const V * Find (uint64_t key) const
+  {
+    return const_cast<FlatHashMap<V> *> (this)->Find (key);
+  }
+  /**
+   * Insert (key, value) if key is unknown, otherwise leave existing value untouched.
+   * \param inserted set to true if a new record was created
+   * \return pointer to the stored value
+   */
+  V * Insert (uint64_t key, V const & value, bool * inserted = 0)
+  {
+    if ((m_size + 1) * 2 > m_slots.size ())
+      Grow ();
+    uint32_t mask = m_slots.size () - 1;
+    uint32_t i = Hash (key) & mask;
+    for (; m_slots[i].used; i = (i + 1) & mask)
+      if (m_slots[i].key == key)
+        {
+          if (inserted)
+            *inserted = false;
+          return &m_slots[i].value;
+        }
+    m_slots[i].used = true;
+    m_slots[i].key = key;
+    m_slots[i].value = value;
+    m_size++;
+    if (inserted)
+      *inserted = true;
+    return &m_slots[i].value;
+  }
+  /// Remove record with given key. \return true if it existed
+  bool Erase (uint64_t key)
+  {
+    if (m_size == 0)
+      return false;
+    uint32_t mask = m_slots.size () - 1;
+    uint32_t i = Hash (key) & mask;
+    for (; m_slots[i].used; i = (i + 1) & mask)
+      if (m_slots[i].key == key)
+        break;
+    if (!m_slots[i].used)
+      return false;
+    // Shift back following records of the probe sequence that may not stay behind the hole
+    for (uint32_t j = (i + 1) & mask; m_slots[j].used; j = (j + 1) & mask)
+      {
+        uint32_t home = Hash (m_slots[j].key) & mask;
+        bool keep = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!keep)
+          {
+            m_slots[i] = m_slots[j];
+            i = j;
+          }
+      }
+    m_slots[i].used = false;
+    m_slots[i].value = V ();
+    m_size--;
+    return true;
+  }
+  /// Number of stored records
+  uint32_t GetSize () const { return m_size; }
+  /// Remove all records
+  void Clear ()
+  {
+    m_slots.clear ();
+    m_size = 0;
+  }
+  ///\name Contiguous walk over the slot array
+  //\{
+  uint32_t GetCapacity () const { return m_slots.size (); }
+  bool IsUsed (uint32_t slot) const { return m_slots[slot].used; }
+  uint64_t GetKey (uint32_t slot) const { return m_slots[slot].key; }
+  V & GetValue (uint32_t slot) { return m_slots[slot].value; }
+  const V & GetValue (uint32_t slot) const { return m_slots[slot].value; }
+  //\}
+
+  /// 64 bit finalizer of MurmurHash3, spreads consecutive addresses and ids over the table
+  static uint32_t Hash (uint64_t key)
+  {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t) key;
+  }
+
+private:
+  struct Slot
+  {
+    Slot () : key (0), value (), used (false) {}
+    uint64_t key;
+    V value;
+    bool used;
+  };
+  /// Double the slot array (minimum 16 slots) and rehash all records
+  void Grow ()
+  {
+    std::vector<Slot> old;
+    old.swap (m_slots);
+    m_slots.resize (old.empty () ? 16 : old.size () * 2);
+    m_size = 0;
+    for (typename std::vector<Slot>::const_iterator i = old.begin (); i != old.end (); ++i)
+      if (i->used)
+        Insert (i->key, i->value);
+  }
+  /// Slot array, size is always a power of two
+  std::vector<Slot> m_slots;
+  /// Number of used slots
+  uint32_t m_size;
+};
+
+}
+}
+#endif /* __AODV_FLAT_HASH_H__ */
@@ -6,31 +6,72 @@ namespace ns3
 {
 namespace aodvmesh
 {
+IdCache::IdCache (Time lifetime) :
+  m_wheel (WHEEL_SIZE), m_lifetime (lifetime)
+{
+  // Wheel covers twice the lifetime, so records normally expire within one revolution
+  m_tickSteps = std::max<int64_t> (lifetime.GetTimeStep () / (WHEEL_SIZE / 2), MilliSeconds (1).GetTimeStep ());
+  m_nextTick = GetTick (Simulator::Now ());
+}
+
 bool
 IdCache::IsDuplicate (Ipv4Address addr, uint32_t id)
 {
-  Purge ();
-  for (std::vector<UniqueId>::const_iterator i = m_idCache.begin ();
-       i != m_idCache.end (); ++i)
-    if (i->m_context == addr && i->m_id == id)
-      return true;
-  struct UniqueId uniqueId =
-  { addr, id, m_lifetime + Simulator::Now () };
-  m_idCache.push_back (uniqueId);
+  Advance ();
+  Time expire = m_lifetime + Simulator::Now ();
+  bool inserted;
+  Time * known = m_idCache.Insert (MakeKey (addr, id), expire, &inserted);
+  if (!inserted)
+    {
+      if (!(*known < Simulator::Now ()))
+        return true;
+      // Expired record not drained yet from the current bucket: treat as new one
+      *known = expire;
+    }
+  m_wheel[GetTick (expire) % WHEEL_SIZE].push_back (MakeKey (addr, id));
   return false;
 }
+
+void
+IdCache::Advance ()
+{
+  int64_t now = GetTick (Simulator::Now ());
+  for (uint32_t n = 0; m_nextTick < now && n < WHEEL_SIZE; ++n, ++m_nextTick)
+    DrainBucket (m_nextTick % WHEEL_SIZE);
+  m_nextTick = std::max (m_nextTick, now);
+}
+
+void
+IdCache::DrainBucket (uint32_t bucket)
+{
+  std::vector<uint64_t> & keys = m_wheel[bucket];
+  std::vector<uint64_t>::iterator last = keys.begin ();
+  for (std::vector<uint64_t>::const_iterator i = keys.begin (); i != keys.end (); ++i)
+    {
+      Time * expire = m_idCache.Find (*i);
+      if (expire == 0)
+        continue;
+      if (*expire < Simulator::Now ())
+        m_idCache.Erase (*i);
+      // Keep records of later wheel revolutions, forget stale keys refreshed into another bucket
+      else if (GetTick (*expire) % WHEEL_SIZE == bucket)
+        *last++ = *i;
+    }
+  keys.erase (last, keys.end ());
+}
+
 void
 IdCache::Purge ()
 {
-  m_idCache.erase (remove_if (m_idCache.begin (), m_idCache.end (),
-                              IsExpired ()), m_idCache.end ());
+  Advance ();
+  DrainBucket (GetTick (Simulator::Now ()) % WHEEL_SIZE);
 }
 
 uint32_t
 IdCache::GetSize ()
 {
   Purge ();
-  return m_idCache.size ();
+  return m_idCache.GetSize ();
 }
 
 //-----------------------------------------------------------------------------
@@ -88,6 +129,7 @@ void
 IdCacheTest::CheckTimeout3 ()
 {
   NS_TEST_EXPECT_MSG_EQ (cache.GetSize (), 0, "All records expire");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 3), false, "Expired record forgotten");
 }
 //-----------------------------------------------------------------------------
 
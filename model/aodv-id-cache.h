@@ -3,6 +3,7 @@
 
 #include "ns3/ipv4-address.h"
 #include "ns3/simulator.h"
+#include "aodv-flat-hash.h"
 #include <vector>
 
 namespace ns3
@@ -13,12 +14,17 @@ namespace aodvmesh
  * \ingroup aodv
  * 
  * \brief Unique packets identification cache used for simple duplicate detection.
+ *
+ * Records are kept in an open addressing hash table keyed on (address, id) and
+ * expired through a coarse timer wheel: every wheel bucket covers one tick of
+ * lifetime / (WHEEL_SIZE / 2) and lists the records whose expiration time falls
+ * into it, so lookup, insertion and purge cost O(1) amortized whatever the cache size.
  */
 class IdCache
 {
 public:
   /// c-tor
-  IdCache (Time lifetime) : m_lifetime (lifetime) {}
+  IdCache (Time lifetime);
   /// Check that entry (addr, id) exists in cache. Add entry, if it doesn't exist.
   bool IsDuplicate (Ipv4Address addr, uint32_t id);
   /// Remove all expired entries
@@ -30,25 +36,27 @@ public:
   /// Return lifetime for existing entries in cache
   Time GetLifeTime () const { return m_lifetime; }
 private:
-  /// Unique packet ID
-  struct UniqueId
+  /// Number of timer wheel buckets
+  static const uint32_t WHEEL_SIZE = 64;
+  /// ID is supposed to be unique in single address context (e.g. sender address)
+  static uint64_t MakeKey (Ipv4Address addr, uint32_t id)
   {
-    /// ID is supposed to be unique in single address context (e.g. sender address)
-    Ipv4Address m_context;
-    /// The id
-    uint32_t m_id;
-    /// When record will expire
-    Time m_expire;
-  };
-  struct IsExpired
-  {
-    bool operator() (const struct UniqueId & u) const
-    {
-      return (u.m_expire < Simulator::Now ());
-    }
-  };
-  /// Already seen IDs
-  std::vector<UniqueId> m_idCache;
+    return (uint64_t (addr.Get ()) << 32) | id;
+  }
+  /// Wheel tick the given absolute time falls into
+  int64_t GetTick (Time t) const { return t.GetTimeStep () / m_tickSteps; }
+  /// Drain all wheel buckets whose tick has completely elapsed
+  void Advance ();
+  /// Remove expired records listed in one wheel bucket
+  void DrainBucket (uint32_t bucket);
+  /// Already seen IDs, (address, id) -> expiration time
+  FlatHashMap<Time> m_idCache;
+  /// Timer wheel, keys of the records expiring in each tick (modulo WHEEL_SIZE)
+  std::vector<std::vector<uint64_t> > m_wheel;
+  /// Wheel resolution in simulator time steps
+  int64_t m_tickSteps;
+  /// First tick whose bucket has not been drained yet
+  int64_t m_nextTick;
   /// Default lifetime for ID records
   Time m_lifetime;
 };
@@ -1,5 +1,6 @@
 #include "aodv-neighbor.h"
 #include "ns3/log.h"
+#include "ns3/test.h"
 #include <algorithm>
 
 NS_LOG_COMPONENT_DEFINE ("AodvNeighbors");
@@ -9,34 +10,318 @@ namespace ns3
 namespace aodvmesh
 {
 Neighbors::Neighbors (Time delay) : 
-  m_ntimer (Timer::CANCEL_ON_DESTROY)
+  m_ntimer (Timer::CANCEL_ON_DESTROY),
+  m_txErrorTimer (Timer::CANCEL_ON_DESTROY),
+  m_txErrors (0),
+  m_txErrorsCoalesced (0),
+  m_txErrorBatches (0),
+  m_bnWords (0),
+  m_adjacencyValid (false),
+  m_epoch (0)
 {
   m_ntimer.SetDelay (delay);
   m_ntimer.SetFunction (&Neighbors::Purge, this);
+  // Zero delay: runs after the events already scheduled for the current time
+  m_txErrorTimer.SetDelay (Seconds (0));
+  m_txErrorTimer.SetFunction (&Neighbors::Purge, this);
   m_txErrorCallback = MakeCallback (&Neighbors::ProcessTxError, this);
 }
 
+/// Value of m_bnDeadlines for slots with no 2-hop deadline queued
+static inline Time
+NoDeadline ()
+{
+  return Seconds (-1);
+}
+
+/// Key of a hardware address in m_macIndex
+static uint64_t
+MacKey (Mac48Address mac)
+{
+  uint8_t buf[6];
+  mac.CopyTo (buf);
+  uint64_t key = 0;
+  for (uint32_t i = 0; i < 6; ++i)
+    key = (key << 8) | buf[i];
+  return key;
+}
+
+/// Orders slots of the live list by neighbor address
+struct SlotAddressLess
+{
+  SlotAddressLess (std::deque<NeighborTuple> const & tuples) : m_tuples (tuples) {}
+  bool operator() (uint32_t slot, uint32_t addr) const
+  {
+    return m_tuples[slot].neighborIfaceAddr.Get () < addr;
+  }
+  std::deque<NeighborTuple> const & m_tuples;
+};
+
+uint32_t
+Neighbors::FindSlot (Ipv4Address addr) const
+{
+  const uint32_t * slot = m_index.Find (addr.Get ());
+  return slot ? *slot : 0xffffffff;
+}
+
+uint32_t
+Neighbors::AddTuple (NeighborTuple const & tuple)
+{
+  uint32_t slot;
+  if (m_freeSlots.empty ())
+    {
+      slot = m_tuples.size ();
+      // Growing a deque at the end keeps references to the other tuples valid
+      m_tuples.push_back (tuple);
+      m_slots.push_back (SlotState ());
+      m_bnDeadlines.push_back (Time ());
+      m_macNext.push_back (0xffffffff);
+    }
+  else
+    {
+      slot = m_freeSlots.back ();
+      m_freeSlots.pop_back ();
+      m_tuples[slot] = tuple;
+    }
+  m_slots[slot].m_used = true;
+  m_index.Insert (tuple.neighborIfaceAddr.Get (), slot);
+  IndexStatus (slot);
+  IndexMac (slot);
+  TopologyChanged ();
+  m_live.insert (std::lower_bound (m_live.begin (), m_live.end (), tuple.neighborIfaceAddr.Get (),
+                                   SlotAddressLess (m_tuples)), slot);
+  PushExpiry (m_expiry, tuple.m_expireTime, slot);
+  m_bnDeadlines[slot] = NoDeadline ();
+  ScheduleBnExpiry (slot);
+  return slot;
+}
+
+void
+Neighbors::IndexMac (uint32_t slot)
+{
+  Mac48Address mac = m_tuples[slot].m_hardwareAddress;
+  if (mac == Mac48Address ())
+    return;
+  bool inserted;
+  uint32_t * first = m_macIndex.Insert (MacKey (mac), slot, &inserted);
+  m_macNext[slot] = inserted ? 0xffffffff : *first;
+  *first = slot;
+}
+
+void
+Neighbors::UnindexMac (uint32_t slot)
+{
+  Mac48Address mac = m_tuples[slot].m_hardwareAddress;
+  if (mac == Mac48Address ())
+    return;
+  uint32_t * first = m_macIndex.Find (MacKey (mac));
+  NS_ASSERT (first != 0);
+  if (*first == slot)
+    {
+      if (m_macNext[slot] == 0xffffffff)
+        m_macIndex.Erase (MacKey (mac));
+      else
+        *first = m_macNext[slot];
+      return;
+    }
+  uint32_t s = *first;
+  while (m_macNext[s] != slot)
+    s = m_macNext[s];
+  m_macNext[s] = m_macNext[slot];
+}
+
+void
+Neighbors::PushExpiry (std::vector<Deadline> & heap, Time time, uint32_t slot)
+{
+  Deadline d;
+  d.m_time = time;
+  d.m_slot = slot;
+  d.m_generation = m_slots[slot].m_generation;
+  heap.push_back (d);
+  std::push_heap (heap.begin (), heap.end ());
+  if (heap.size () > 2 * m_live.size () + 64)
+    CompactExpiry (heap);
+  if (!m_ntimer.IsRunning () || time < m_purgeTime)
+    ScheduleTimer ();
+}
+
+void
+Neighbors::ScheduleBnExpiry (uint32_t slot)
+{
+  MulticastBnNeighborSet const & bn = m_tuples[slot].neighborBnNeighbors;
+  if (bn.empty ())
+    {
+      m_bnDeadlines[slot] = NoDeadline ();
+      return;
+    }
+  Time first = bn.front ().twoHopBnNeighborTimeout;
+  for (MulticastBnNeighborSet::const_iterator i = bn.begin (); i != bn.end (); ++i)
+    first = std::min (first, i->twoHopBnNeighborTimeout);
+  // The deadline already queued still stands
+  if (first == m_bnDeadlines[slot])
+    return;
+  m_bnDeadlines[slot] = first;
+  PushExpiry (m_bnExpiry, first, slot);
+}
+
+bool
+Neighbors::IsCurrent (Deadline const & d, bool bn) const
+{
+  SlotState const & state = m_slots[d.m_slot];
+  return state.m_used && state.m_generation == d.m_generation && (!bn || m_bnDeadlines[d.m_slot] == d.m_time);
+}
+
+void
+Neighbors::CompactExpiry (std::vector<Deadline> & heap)
+{
+  bool bn = &heap == &m_bnExpiry;
+  std::vector<Deadline> live;
+  live.reserve (m_live.size ());
+  for (std::vector<Deadline>::const_iterator i = heap.begin (); i != heap.end (); ++i)
+    if (IsCurrent (*i, bn))
+      live.push_back (*i);
+  std::make_heap (live.begin (), live.end ());
+  heap.swap (live);
+}
+
+void
+Neighbors::ReleaseSlot (uint32_t slot)
+{
+  m_index.Erase (m_tuples[slot].neighborIfaceAddr.Get ());
+  UnindexStatus (slot);
+  UnindexMac (slot);
+  m_slots[slot].m_used = false;
+  m_slots[slot].m_generation++;
+  TopologyChanged ();
+  // Drop the two hop list held by the released tuple
+  m_tuples[slot] = NeighborTuple (Ipv4Address (), Time ());
+  m_freeSlots.push_back (slot);
+}
+
+void
+Neighbors::EraseSlot (uint32_t slot)
+{
+  std::vector<uint32_t>::iterator i = std::lower_bound (m_live.begin (), m_live.end (),
+                                                        m_tuples[slot].neighborIfaceAddr.Get (),
+                                                        SlotAddressLess (m_tuples));
+  NS_ASSERT (i != m_live.end () && *i == slot);
+  m_live.erase (i);
+  ReleaseSlot (slot);
+}
+
+uint32_t
+Neighbors::GetBucket (uint32_t status)
+{
+  return status <= NEIGH_NODE ? status : 0;
+}
+
+Neighbors::BestKey
+Neighbors::GetBestKey (uint32_t slot) const
+{
+  SlotState const & state = m_slots[slot];
+  BestKey key;
+  key.m_weight = state.m_weight;
+  key.m_class = state.m_indicator == CONVERT_BREAK ? BestKey::BREAK : state.m_indicator;
+  key.m_address = m_tuples[slot].neighborIfaceAddr.Get ();
+  return key;
+}
+
+void
+Neighbors::IndexStatus (uint32_t slot)
+{
+  NeighborTuple const & nt = m_tuples[slot];
+  SlotState & state = m_slots[slot];
+  state.m_status = nt.neighborNodeStatus;
+  state.m_client = nt.neighborClient;
+  state.m_weight = nt.neighborWeight;
+  state.m_indicator = nt.neighborcore_noncoreIndicator;
+  std::vector<uint32_t> & bucket = m_byStatus[GetBucket (state.m_status)];
+  bucket.insert (std::lower_bound (bucket.begin (), bucket.end (), nt.neighborIfaceAddr.Get (),
+                                   SlotAddressLess (m_tuples)), slot);
+  std::vector<BestKey> & best = m_best[GetBucket (state.m_status)];
+  BestKey key = GetBestKey (slot);
+  best.insert (std::lower_bound (best.begin (), best.end (), key), key);
+}
+
+void
+Neighbors::UnindexStatus (uint32_t slot)
+{
+  uint32_t b = GetBucket (m_slots[slot].m_status);
+  std::vector<uint32_t>::iterator i = std::lower_bound (m_byStatus[b].begin (), m_byStatus[b].end (),
+                                                        m_tuples[slot].neighborIfaceAddr.Get (),
+                                                        SlotAddressLess (m_tuples));
+  NS_ASSERT (i != m_byStatus[b].end () && *i == slot);
+  m_byStatus[b].erase (i);
+  BestKey key = GetBestKey (slot);
+  m_best[b].erase (std::lower_bound (m_best[b].begin (), m_best[b].end (), key));
+}
+
+/// True for slots released since the live list was last compacted
+struct SlotUnused
+{
+  SlotUnused (std::vector<Neighbors::SlotState> const & slots) : m_slots (slots) {}
+  bool operator() (uint32_t slot) const
+  {
+    return !m_slots[slot].m_used;
+  }
+  std::vector<Neighbors::SlotState> const & m_slots;
+};
+
+void
+Neighbors::ReleaseSlots (std::vector<uint32_t> const & slots)
+{
+  if (slots.empty ())
+    return;
+  for (std::vector<uint32_t>::const_iterator s = slots.begin (); s != slots.end (); ++s)
+    ReleaseSlot (*s);
+  m_live.erase (std::remove_if (m_live.begin (), m_live.end (), SlotUnused (m_slots)), m_live.end ());
+}
+
+bool
+Neighbors::LookupHandle (Ipv4Address addr, Handle & handle) const
+{
+  uint32_t slot = FindSlot (addr);
+  if (slot == 0xffffffff)
+    return false;
+  handle.m_slot = slot;
+  handle.m_generation = m_slots[slot].m_generation;
+  return true;
+}
+
+NeighborTuple *
+Neighbors::GetTuple (Handle handle)
+{
+  if (handle.m_slot >= m_slots.size () || !m_slots[handle.m_slot].m_used
+      || m_slots[handle.m_slot].m_generation != handle.m_generation)
+    return 0;
+  return &m_tuples[handle.m_slot];
+}
+
+void
+Neighbors::Clear ()
+{
+  // Release rather than drop the slots, so handles taken before stay stale
+  std::vector<uint32_t> live;
+  live.swap (m_live);
+  for (std::vector<uint32_t>::const_iterator s = live.begin (); s != live.end (); ++s)
+    ReleaseSlot (*s);
+  m_expiry.clear ();
+  m_bnExpiry.clear ();
+}
+
 bool
 Neighbors::IsNeighbor (Ipv4Address addr)
 {
   Purge ();
-  for (NeighborSet::const_iterator i = localNeighborList.begin (); i != localNeighborList.end (); ++i)
-    {
-      if (i->neighborIfaceAddr == addr)
-        return true;
-    }
-  return false;
+  return FindSlot (addr) != 0xffffffff;
 }
 
 
 NeighborTuple*
 Neighbors::FindNeighborTuple(const Ipv4Address &neighborAddress) {
 	NS_LOG_FUNCTION(this);
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++){
-		if (nt->neighborIfaceAddr == neighborAddress )
-			return &(*nt);
-	}
-	return NULL;
+	uint32_t slot = FindSlot (neighborAddress);
+	return slot == 0xffffffff ? NULL : &m_tuples[slot];
 }
 
 Time
@@ -44,12 +329,9 @@ Neighbors::GetExpireTime (Ipv4Address addr)
 {
   NS_LOG_FUNCTION(this);
   Purge ();
-  for (NeighborSet::const_iterator i = localNeighborList.begin (); i
-      != localNeighborList.end (); ++i)
-    {
-      if (i->neighborIfaceAddr == addr)
-        return (i->m_expireTime - Simulator::Now ());
-    }
+  uint32_t slot = FindSlot (addr);
+  if (slot != 0xffffffff)
+    return (m_tuples[slot].m_expireTime - Simulator::Now ());
   return Seconds (0);
 }
 
@@ -57,20 +339,35 @@ void
 Neighbors::Update (Ipv4Address addr, Time expire)
 {
   NS_LOG_FUNCTION(this);
-  for (NeighborSet::iterator i = localNeighborList.begin (); i != localNeighborList.end (); ++i)
-    if (i->neighborIfaceAddr == addr)
-      {
-        i->m_expireTime = std::max (expire + Simulator::Now (), i->m_expireTime);
-        if (i->m_hardwareAddress == Mac48Address ())
-          i->m_hardwareAddress = LookupMacAddress (i->neighborIfaceAddr);
-        return;
-      }
+  uint32_t slot = FindSlot (addr);
+  if (slot != 0xffffffff)
+    {
+      NeighborTuple & i = m_tuples[slot];
+      i.m_expireTime = std::max (expire + Simulator::Now (), i.m_expireTime);
+      if (i.m_hardwareAddress == Mac48Address ())
+        {
+          i.m_hardwareAddress = LookupMacAddress (i.neighborIfaceAddr);
+          IndexMac (slot);
+        }
+      return;
+    }
   NS_LOG_INFO ("Open link to " << addr);
-  NeighborTuple neighbor (addr, LookupMacAddress (addr), expire + Simulator::Now ());
-  localNeighborList.push_back (neighbor);
+  AddTuple (NeighborTuple (addr, LookupMacAddress (addr), expire + Simulator::Now ()));
   Purge ();
 }
 
+void
+Neighbors::Touch (Ipv4Address addr, Time expire)
+{
+  uint32_t slot = FindSlot (addr);
+  // A neighbor without hardware address needs the ARP lookup of Update (), an unknown one is created
+  if (slot == 0xffffffff || m_tuples[slot].m_hardwareAddress == Mac48Address ())
+    {
+      Update (addr, expire);
+      return;
+    }
+  m_tuples[slot].m_expireTime = std::max (expire + Simulator::Now (), m_tuples[slot].m_expireTime);
+}
 
 void Neighbors::UpdateNeighborTuple(HelloHeader *helloHeader, bool helloClient){
 	NS_LOG_FUNCTION(this);
@@ -89,6 +386,16 @@ void Neighbors::UpdateNeighborTuple(HelloHeader *helloHeader, bool helloClient){
 	tp->neighborNodeStatus = helloHeader->GetNodeStatus();
 	tp->neighborcore_noncoreIndicator = helloHeader->Getcore_noncoreIndicator();
 	tp->neighborClient = helloClient;
+	uint32_t slot = FindSlot (tp->neighborIfaceAddr);
+	SlotState const & state = m_slots[slot];
+	if (state.m_status != tp->neighborNodeStatus || state.m_weight != tp->neighborWeight
+	    || state.m_indicator != tp->neighborcore_noncoreIndicator) {
+		if (state.m_status != tp->neighborNodeStatus)
+			m_epoch++;
+		UnindexStatus (slot);
+		IndexStatus (slot);
+	} else
+		m_slots[slot].m_client = tp->neighborClient;
 }
 
 void
@@ -96,27 +403,27 @@ Neighbors::UpdateMulticastNeighborTuple(HelloHeader *helloMessage, Time nextTime
 	NS_LOG_FUNCTION(this);
 	NeighborTuple *neighbor = FindNeighborTuple(helloMessage->GetOriginatorAddress());
 	MulticastBnNeighborSet updates = helloMessage->GetMulticastNeighborSet();
-	neighbor->neighborBnNeighbors.clear();
 	nextTime += Simulator::Now();
-	for(MulticastBnNeighborSet::const_iterator iter = updates.begin(); iter != updates.end();iter++){
-		MulticastBnNeighborTuple twohop = *iter;
-		twohop.twoHopBnNeighborTimeout = nextTime;
-		neighbor->neighborBnNeighbors.push_back(twohop);
-	}
-	neighbor->neighborBnNeighbors.sort(compare2IP);
+	for(MulticastBnNeighborSet::iterator iter = updates.begin(); iter != updates.end();iter++)
+		iter->twoHopBnNeighborTimeout = nextTime;
+	updates.sort(compare2IP);
+	// Most hellos repeat the list they replace; only a different address set changes the topology
+	bool changed = updates.size () != neighbor->neighborBnNeighbors.size ();
+	for (MulticastBnNeighborSet::const_iterator i = updates.begin (), j = neighbor->neighborBnNeighbors.begin ();
+	     !changed && i != updates.end (); ++i, ++j)
+		changed = i->twoHopBnNeighborIfaceAddr != j->twoHopBnNeighborIfaceAddr;
+	neighbor->neighborBnNeighbors.swap(updates);
+	if (changed)
+		TopologyChanged ();
+	ScheduleBnExpiry (FindSlot (neighbor->neighborIfaceAddr));
 }
 
 void
 Neighbors::EraseNeighborTuple(const Ipv4Address &neighborAddress) {
 	NS_LOG_FUNCTION(this);
-	uint16_t size = localNeighborList.size();
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++){ //&& nt->neighborIfaceAddr.Get() <= neighborAddress.Get(); nt++) {
-		if (nt->neighborIfaceAddr == neighborAddress){
-			nt = localNeighborList.erase (nt);
-			NS_ASSERT (size == 1 + localNeighborList.size());
-			break;
-		}
-	}
+	uint32_t slot = FindSlot (neighborAddress);
+	if (slot != 0xffffffff)
+		EraseSlot (slot);
 }
 
 void
@@ -129,22 +436,43 @@ void
 Neighbors::InsertNeighborTuple(const NeighborTuple &neighborTuple) {
 	NS_LOG_FUNCTION(this);
 	EraseNeighborTuple(neighborTuple);// remove old entry
-	localNeighborList.push_back(neighborTuple);// add new entry
-	localNeighborList.sort(compare1IP);//and sort the list
+	AddTuple(neighborTuple);// add new entry, in address order
 }
 
 void
 Neighbors::PrintLocalNeighborList(){
 	NS_LOG_FUNCTION(this);
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt!= localNeighborList.end(); nt++) {
+	for (std::vector<uint32_t>::const_iterator s = m_live.begin(); s != m_live.end(); s++) {
+		NeighborTuple *nt = &m_tuples[*s];
 		NS_LOG_INFO(*nt);
-		MulticastBnNeighborSet nset = nt->neighborBnNeighbors;
-		for (MulticastBnNeighborSet::iterator twohop = nset.begin() ; twohop != nset.end(); twohop++) {
+		MulticastBnNeighborSet const & nset = nt->neighborBnNeighbors;
+		for (MulticastBnNeighborSet::const_iterator twohop = nset.begin() ; twohop != nset.end(); twohop++) {
 			NS_LOG_INFO("\t"<<*twohop);
 		}
 	}
 }
 
+void
+Neighbors::Snapshot (SnapshotWriter & writer)
+{
+  for (std::vector<uint32_t>::const_iterator s = m_live.begin (); s != m_live.end (); ++s)
+    {
+      NeighborTuple const * i = &m_tuples[*s];
+      SnapshotNeighbor n;
+      n.m_address = i->neighborIfaceAddr.Get ();
+      n.m_weight = i->neighborWeight;
+      n.m_associatedCore = i->neighborAssociatedCORE.Get ();
+      n.m_expireTime = (i->m_expireTime - Simulator::Now ()).GetNanoSeconds ();
+      n.m_helloCounter = i->helloCounter;
+      n.m_bnNeighbors = std::min<size_t> (i->neighborBnNeighbors.size (), 0xffff);
+      n.m_status = i->neighborNodeStatus;
+      n.m_indicator = i->neighborcore_noncoreIndicator;
+      n.m_bits = (i->close ? SnapshotNeighbor::CLOSE : 0) | (i->neighborClient ? SnapshotNeighbor::CLIENT : 0)
+        | (i->m_hardwareAddress != Mac48Address () ? SnapshotNeighbor::HARDWARE_ADDRESS : 0);
+      writer.AddNeighbor (n);
+    }
+}
+
 MulticastBnNeighborTuple*
 Neighbors::FindMulticastBnNeighborTuple(const Ipv4Address &oneHopNeighbor,
 		const Ipv4Address &twoHopNeighbor) {
@@ -171,6 +499,7 @@ Neighbors::EraseMulticastBnNeighborTuple (const Ipv4Address &oneHopNeighbor, con
 		if (nt->twoHopBnNeighborIfaceAddr == twoHopNeighbor ){
 			nt = neighbor->neighborBnNeighbors.erase (nt);
 			NS_ASSERT (size == 1+ neighbor->neighborBnNeighbors.size());
+			TopologyChanged ();
 		}
 	}
 }
@@ -178,7 +507,8 @@ Neighbors::EraseMulticastBnNeighborTuple (const Ipv4Address &oneHopNeighbor, con
 MulticastBnNeighborTuple*
 Neighbors::FindMulticastBnNeighborTuple(const Ipv4Address &twoHopNeighbor) {
 	NS_LOG_FUNCTION(this);
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++){ // && nt->neighborIfaceAddr.Get() <= neighborAddress.Get(); nt++) {
+	for (std::vector<uint32_t>::const_iterator s = m_live.begin(); s != m_live.end(); s++) { // && nt->neighborIfaceAddr.Get() <= neighborAddress.Get(); nt++) {
+		NeighborTuple *nt = &m_tuples[*s];
 		for (MulticastBnNeighborSet::iterator nt2 = nt->neighborBnNeighbors.begin(); nt2 != nt->neighborBnNeighbors.end(); nt2++){// && nt->twoHopBnNeighborIfaceAddr.Get() <= twoHopNeighbor.Get(); nt++) {
 			if (nt2->twoHopBnNeighborIfaceAddr == twoHopNeighbor){
 				return &(*nt2);
@@ -192,7 +522,8 @@ MulticastBnNeighborSet
 Neighbors::GetBnNeighbors(){
 	NS_LOG_FUNCTION(this);
 	MulticastBnNeighborSet tset;
-	for(NeighborSet::iterator ns = localNeighborList.begin();  ns != localNeighborList.end(); ns++){
+	for (std::vector<uint32_t>::const_iterator s = m_live.begin(); s != m_live.end(); s++) {
+		NeighborTuple *ns = &m_tuples[*s];
 		if(ns->neighborNodeStatus != NEIGH_NODE) continue;
 		MulticastBnNeighborTuple tp (ns->neighborIfaceAddr, ns->neighborWeight, ns->neighborcore_noncoreIndicator, ns->m_expireTime);
 		tset.push_back(tp);
@@ -204,18 +535,30 @@ Neighbors::GetBnNeighbors(){
 uint32_t
 Neighbors::GetNeighborhoodSize(NodeStatus nodeStatus) {
 	NS_LOG_FUNCTION(this);
-	int size = 0;
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++) {
-		if (nt->neighborNodeStatus == nodeStatus)
-			size++;
-	}
-	return size;
+	if (GetBucket (nodeStatus) != uint32_t (nodeStatus))
+		return GetOneHopNeighborView(nodeStatus).size ();
+	return m_byStatus[nodeStatus].size ();
+}
+
+uint32_t
+Neighbors::GetBNNeighborhoodSize() {
+	return GetNeighborhoodSize(NEIGH_NODE);
+}
+
+uint32_t
+Neighbors::GetBCNNeighborhoodSize() {
+	return GetNeighborhoodSize(CORE);
+}
+
+uint32_t
+Neighbors::GetRNNeighborhoodSize() {
+	return GetNeighborhoodSize(RN_NODE);
 }
 
 uint32_t
 Neighbors::GetNeighborhoodSize() {
 	NS_LOG_FUNCTION(this);
-	return localNeighborList.size();
+	return m_live.size();
 }
 
 
@@ -223,52 +566,73 @@ NeighborTuple*
 Neighbors::GetBestNeighbor(aodvmesh::NodeStatus nodeStatus) {
 	NS_LOG_FUNCTION(this);
 	NeighborTuple *best = NULL;
-	NeighborSet::iterator ntend = localNeighborList.end();
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != ntend; nt++) {
-		if (nt->neighborNodeStatus == nodeStatus && (best == NULL ||//initialize best
-				*nt > *best )) {//compare with best
-			best = &(*nt);
-		}
+	if (GetBucket (nodeStatus) != uint32_t (nodeStatus)) {
+		View view = GetOneHopNeighborView(nodeStatus);
+		for (View::const_iterator nt = view.begin(); nt != view.end(); nt++)
+			if (best == NULL || *nt > *best)
+				best = &(*nt);
+	} else if (!m_best[nodeStatus].empty()) {
+		best = FindNeighborTuple (Ipv4Address (GetBestAddress (m_best[nodeStatus])));
+	}
+	if (best==NULL) {
+		NS_LOG_INFO((nodeStatus==NEIGH_NODE?"BN":(nodeStatus==CORE?"BCN":"RN")) << " set: Best neighbor = NULL");
+	} else {
+		NS_LOG_INFO((nodeStatus==NEIGH_NODE?"BN":(nodeStatus==CORE?"BCN":"RN")) << " set: Best neighbor = " << *best);
 	}
-	std::stringstream ss;
-	ss << (nodeStatus==NEIGH_NODE?"BN":(nodeStatus==CORE?"BCN":"RN")) << " set: Best neighbor = ";
-	if (best==NULL)
-		ss<< "NULL";
-	else
-		ss << *best;
-	NS_LOG_INFO(ss.str());
 	return best;
 }
 
+uint32_t
+Neighbors::GetBestAddress (std::vector<BestKey> const & keys)
+{
+  /*
+   * operator> is not a total order: at equal weight an ALLOW and an OTHER neighbor are not comparable.
+   * The scan it was written for visits neighbors in address order and keeps the current best unless
+   * a later one compares greater. So the result lies among the highest weight; it is the BREAK neighbor
+   * with the highest address if there is one, else the highest address neighbor with the indicator of
+   * the lowest address neighbor of that weight.
+   */
+  BestKey const & top = keys.back ();
+  if (top.m_class == BestKey::BREAK)
+    return top.m_address;
+  BestKey first = top;
+  BestKey key;
+  key.m_weight = top.m_weight;
+  key.m_address = 0;
+  for (key.m_class = 0; key.m_class < BestKey::BREAK; key.m_class++)
+    {
+      std::vector<BestKey>::const_iterator i = std::lower_bound (keys.begin (), keys.end (), key);
+      if (i == keys.end () || i->m_weight != top.m_weight)
+        break;
+      if (i->m_address < first.m_address)
+        first = *i;
+      key.m_class = i->m_class;
+    }
+  // Last key of the class of first
+  key.m_class = first.m_class + 1;
+  return (std::lower_bound (keys.begin (), keys.end (), key) - 1)->m_address;
+}
+
 NeighborSet
 Neighbors::GetOneHopNeighbors(aodvmesh::NodeStatus nodeStatus) {
 	NS_LOG_FUNCTION(this);
-	NeighborSet ns;
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++) {
-		if (nt->neighborNodeStatus == nodeStatus) {
-			ns.push_back(*nt);
-		}
-	}
-	return ns;
+	View view = GetOneHopNeighborView(nodeStatus);
+	return NeighborSet(view.begin(), view.end());
 }
 
 NeighborSet
 Neighbors::GetClients(aodvmesh::NodeStatus nodeStatus) {
 	NS_LOG_FUNCTION(this);
-	NeighborSet ns;
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++) {
-		if (nt->neighborClient && nt->neighborNodeStatus == nodeStatus) {
-			ns.push_back(*nt);
-		}
-	}
-	return ns;
+	View view = GetClientView(nodeStatus);
+	return NeighborSet(view.begin(), view.end());
 }
 
 NeighborSet
 Neighbors::GetClients() {
 	NS_LOG_FUNCTION(this);
 	NeighborSet ns;
-	for (NeighborSet::iterator nt = localNeighborList.begin(); nt != localNeighborList.end(); nt++) {
+	for (std::vector<uint32_t>::const_iterator s = m_live.begin(); s != m_live.end(); s++) {
+		NeighborTuple *nt = &m_tuples[*s];
 		if (nt->neighborClient) {
 			ns.push_back(*nt);
 		}
@@ -279,17 +643,7 @@ Neighbors::GetClients() {
 bool
 Neighbors::Are1HopNeighbors(const Ipv4Address &BNnode_v, const Ipv4Address &BNnode_w) {
 	NS_LOG_FUNCTION(this);
-	bool directly_connected = false;
-	AddressSet bnv = GetMulticastNeighbors(BNnode_v);
-	AddressSet bnw = GetMulticastNeighbors(BNnode_w);
-	directly_connected = !(Intersection(bnv, BNnode_w).empty() && Intersection(bnw, BNnode_v).empty());
-//	NeighborTuple *node_v = FindNeighborTuple(BNnode_v);
-//	if(node_v == NULL) return false; // don't influence the result
-//	for (MulticastBnNeighborSet::iterator two_hops = node_v->neighborBnNeighbors.begin();
-//			two_hops != node_v->neighborBnNeighbors.end() && !directly_connected; two_hops++) {
-//		directly_connected = (two_hops -> twoHopBnNeighborIfaceAddr == BNnode_w);
-//	}
-	return directly_connected;
+	return HasBnNeighbor (BNnode_v, BNnode_w) || HasBnNeighbor (BNnode_w, BNnode_v);
 }
 
 AddressSet
@@ -342,9 +696,7 @@ Neighbors::Intersection(AddressSet set1, Ipv4Address address){
 bool
 Neighbors::Are2HopNeighbors(const Ipv4Address &BNnode_v, const Ipv4Address &BNnode_w) {
 	NS_LOG_FUNCTION(this);
-	AddressSet vset = GetMulticastNeighbors(BNnode_v);
-	AddressSet wset = GetMulticastNeighbors(BNnode_w);
-	return (!Intersection(vset,wset).empty());
+	return HaveCommonBn (BNnode_v, BNnode_w);
 }
 
 Groups
@@ -376,56 +728,134 @@ Neighbors::PrintAddressSet(AddressSet set){
 AddressSet
 Neighbors::GetCommonBN(NeighborPair bn_pair) {
 	NS_LOG_FUNCTION(this);
-	AddressSet node_v = GetMulticastNeighbors(bn_pair.neighborFirstIfaceAddr);
-	AddressSet node_w = GetMulticastNeighbors(bn_pair.neighborSecondIfaceAddr);
-	AddressSet commonBN = Intersection(node_v,node_w);
-	//COMMENT down
-//	for(AddressSet::iterator inter = commonBN.begin(); inter != commonBN.end(); inter++){
-//		NS_ASSERT (FindMulticastBnNeighborTuple(bn_pair.neighborFirstIfaceAddr, *inter) &&
-//				FindMulticastBnNeighborTuple(bn_pair.neighborSecondIfaceAddr, *inter));
-//	}
-	return commonBN;
+	CommonBnView common = GetCommonBnView (bn_pair);
+	return AddressSet (common.begin (), common.end ());
+}
+
+Neighbors::CommonBnView
+Neighbors::GetCommonBnView (NeighborPair bn_pair)
+{
+  const uint64_t * v = GetBnRow (bn_pair.neighborFirstIfaceAddr);
+  const uint64_t * w = GetBnRow (bn_pair.neighborSecondIfaceAddr);
+  // Bits are numbered in address order, so the view is sorted like GetMulticastNeighbors ()
+  return CommonBnView (v, w, m_bnWords, &m_universe);
+}
+
+MulticastBnNeighborSet const &
+Neighbors::GetBnNeighborList (Ipv4Address neighbor)
+{
+  NeighborTuple *nt = FindNeighborTuple (neighbor);
+  NS_ASSERT (nt != NULL);
+  return nt->neighborBnNeighbors;
+}
+
+void
+Neighbors::BuildAdjacency ()
+{
+  m_universe.clear ();
+  for (std::vector<uint32_t>::const_iterator s = m_live.begin (); s != m_live.end (); ++s)
+    {
+      NeighborTuple const & nt = m_tuples[*s];
+      m_universe.push_back (nt.neighborIfaceAddr.Get ());
+      for (MulticastBnNeighborSet::const_iterator i = nt.neighborBnNeighbors.begin (); i != nt.neighborBnNeighbors.end (); ++i)
+        m_universe.push_back (i->twoHopBnNeighborIfaceAddr.Get ());
+    }
+  std::sort (m_universe.begin (), m_universe.end ());
+  m_universe.erase (std::unique (m_universe.begin (), m_universe.end ()), m_universe.end ());
+  m_universeIndex.Clear ();
+  for (uint32_t i = 0; i < m_universe.size (); ++i)
+    m_universeIndex.Insert (m_universe[i], i);
+
+  m_bnWords = (m_universe.size () + 63) / 64;
+  m_bnBits.assign (m_tuples.size () * m_bnWords, 0);
+  for (std::vector<uint32_t>::const_iterator s = m_live.begin (); s != m_live.end (); ++s)
+    {
+      uint64_t * row = m_bnWords ? &m_bnBits[*s * m_bnWords] : 0;
+      NeighborTuple const & nt = m_tuples[*s];
+      for (MulticastBnNeighborSet::const_iterator i = nt.neighborBnNeighbors.begin (); i != nt.neighborBnNeighbors.end (); ++i)
+        {
+          uint32_t bit = *m_universeIndex.Find (i->twoHopBnNeighborIfaceAddr.Get ());
+          row[bit / 64] |= uint64_t (1) << (bit % 64);
+        }
+    }
+  m_adjacencyValid = true;
+}
+
+const uint64_t *
+Neighbors::GetBnRow (Ipv4Address neighbor)
+{
+  if (!m_adjacencyValid)
+    BuildAdjacency ();
+  uint32_t slot = FindSlot (neighbor);
+  NS_ASSERT (slot != 0xffffffff);
+  return m_bnWords ? &m_bnBits[slot * m_bnWords] : 0;
+}
+
+bool
+Neighbors::HasBnNeighbor (Ipv4Address neighbor, Ipv4Address bn)
+{
+  const uint64_t * row = GetBnRow (neighbor);
+  const uint32_t * bit = m_universeIndex.Find (bn.Get ());
+  return bit && ((row[*bit / 64] >> (*bit % 64)) & 1);
+}
+
+bool
+Neighbors::HaveCommonBn (Ipv4Address v, Ipv4Address w)
+{
+  const uint64_t * a = GetBnRow (v);
+  const uint64_t * b = GetBnRow (w);
+  for (uint32_t i = 0; i < m_bnWords; ++i)
+    if (a[i] & b[i])
+      return true;
+  return false;
 }
 
 void
 Neighbors::ResetHelloCounter (){
-for (NeighborSet::iterator iter = localNeighborList.begin(); iter != localNeighborList.end(); iter++)
-			ResetHelloCounter(&(*iter));
+for (std::vector<uint32_t>::const_iterator s = m_live.begin(); s != m_live.end(); s++)
+			ResetHelloCounter(&m_tuples[*s]);
+}
+
+void
+Neighbors::RemoveDead ()
+{
+  if (m_dead.empty ())
+    return;
+  // Callbacks run once the table is consistent again, and may purge it themselves
+  std::vector<Ipv4Address> failed;
+  failed.swap (m_failed);
+  failed.clear ();
+  for (std::vector<uint32_t>::const_iterator s = m_dead.begin (); s != m_dead.end (); ++s)
+    failed.push_back (m_tuples[*s].neighborIfaceAddr);
+  ReleaseSlots (m_dead);
+  if (!m_handleLinkFailures.IsNull ())
+    m_handleLinkFailures (failed);
+  else if (!m_handleLinkFailure.IsNull ())
+    for (std::vector<Ipv4Address>::const_iterator i = failed.begin (); i != failed.end (); ++i)
+      m_handleLinkFailure (*i);
+  m_failed.swap (failed);
 }
 
 void
 Neighbors::PurgeHello ()
 {
   NS_LOG_FUNCTION(this << GetMinHello());
-  if (localNeighborList.empty ())
+  if (m_live.empty ())
     return;
 
-  NeighborSet newset;
-  if (!m_handleLinkFailure.IsNull ())
+  m_dead.clear ();
+  for (std::vector<uint32_t>::const_iterator s = m_live.begin (); s != m_live.end (); ++s)
     {
-      for (NeighborSet::iterator j = localNeighborList.begin (); j != localNeighborList.end (); ++j)
+      NeighborTuple const & nt = m_tuples[*s];
+      if (!HasLinkFailureCallback () || nt.helloCounter < GetMinHello())
         {
-          if (j->helloCounter < GetMinHello())
-            {
-              NS_LOG_INFO ("Removing "<< *j<< ":" << j->helloCounter<< "/"<< GetMinHello());
-              m_handleLinkFailure (j->neighborIfaceAddr);
-            }
-          else
-        	  newset.push_back(*j);
+          NS_LOG_INFO ("Removing "<< nt << ":" << nt.helloCounter<< "/"<< GetMinHello());
+          m_dead.push_back (*s);
         }
     }
-  localNeighborList = newset;
+  RemoveDead ();
 }
 
-struct CloseOneHopNeighbor
-{
-  bool operator() (const NeighborTuple & nb) const
-  {
-    return ((nb.m_expireTime < Simulator::Now ()) || nb.close);
-  }
-};
-
-
 struct CloseMulticastNeighbor
 {
   bool operator() (const MulticastBnNeighborTuple & nb) const
@@ -435,41 +865,112 @@ struct CloseMulticastNeighbor
 };
 
 void
-Neighbors::Purge ()
+Neighbors::CollectExpired ()
 {
-  NS_LOG_FUNCTION(this);
-  if (localNeighborList.empty ())
-    return;
-  NeighborSet newset;
-  CloseOneHopNeighbor pred;
-  CloseMulticastNeighbor pred2;
-  if (!m_handleLinkFailure.IsNull ())
+  if (!HasLinkFailureCallback ())
+    {
+      // Without link failure callback every neighbor goes
+      m_dead.clear ();
+      for (std::vector<uint32_t>::const_iterator s = m_live.begin (); s != m_live.end (); ++s)
+        {
+          NS_LOG_INFO ("Link expired towards: " << m_tuples[*s]);
+          m_dead.push_back (*s);
+        }
+      return;
+    }
+  if (!m_txFailed.empty ())
+    {
+      m_txErrorBatches++;
+      for (std::vector<Handle>::const_iterator h = m_txFailed.begin (); h != m_txFailed.end (); ++h)
+        if (GetTuple (*h))
+          m_dead.push_back (h->m_slot);
+    }
+  Time now = Simulator::Now ();
+  while (!m_expiry.empty () && m_expiry.front ().m_time < now)
     {
-      for (NeighborSet::iterator j = localNeighborList.begin (); j != localNeighborList.end (); ++j)
+      Deadline d = m_expiry.front ();
+      std::pop_heap (m_expiry.begin (), m_expiry.end ());
+      m_expiry.pop_back ();
+      if (!IsCurrent (d, false))
+        continue;
+      NeighborTuple const & nt = m_tuples[d.m_slot];
+      // Closed tuples are collected from m_txFailed
+      if (nt.close)
+        continue;
+      if (nt.m_expireTime < now)
         {
-          if (pred (*j))
-            {
-              NS_LOG_INFO ("Link expired towards: " << *j);
-              m_handleLinkFailure (j->neighborIfaceAddr);
-            }
-          else {
-        	  newset.push_back(*j);
-        	  if(!(j->neighborBnNeighbors.empty())){
-        		  j->neighborBnNeighbors.erase (std::remove_if (j->neighborBnNeighbors.begin (), j->neighborBnNeighbors.end (), pred2), j->neighborBnNeighbors.end ());
-        	  }
-          }
+          NS_LOG_INFO ("Link expired towards: " << nt);
+          m_dead.push_back (d.m_slot);
         }
+      else
+        // Refreshed since queued, requeue at the current expire time
+        PushExpiry (m_expiry, nt.m_expireTime, d.m_slot);
+    }
+  while (!m_bnExpiry.empty () && m_bnExpiry.front ().m_time < now)
+    {
+      Deadline d = m_bnExpiry.front ();
+      std::pop_heap (m_bnExpiry.begin (), m_bnExpiry.end ());
+      m_bnExpiry.pop_back ();
+      if (!IsCurrent (d, true))
+        continue;
+      MulticastBnNeighborSet & bn = m_tuples[d.m_slot].neighborBnNeighbors;
+      size_t size = bn.size ();
+      bn.remove_if (CloseMulticastNeighbor ());
+      if (bn.size () != size)
+        TopologyChanged ();
+      m_bnDeadlines[d.m_slot] = NoDeadline ();
+      ScheduleBnExpiry (d.m_slot);
+    }
+}
+
+void
+Neighbors::Purge ()
+{
+  NS_LOG_FUNCTION(this);
+  if (m_live.empty ())
+    {
+      m_txFailed.clear ();
+      return;
     }
-  localNeighborList.clear();
-  localNeighborList = newset;
+  m_dead.clear ();
+  CollectExpired ();
+  m_txFailed.clear ();
+  m_txErrorTimer.Cancel ();
+  RemoveDead ();
   ScheduleTimer();
 }
 
 void
 Neighbors::ScheduleTimer ()
 {
+  while (!m_expiry.empty () && !IsCurrent (m_expiry.front (), false))
+    {
+      std::pop_heap (m_expiry.begin (), m_expiry.end ());
+      m_expiry.pop_back ();
+    }
+  while (!m_bnExpiry.empty () && !IsCurrent (m_bnExpiry.front (), true))
+    {
+      std::pop_heap (m_bnExpiry.begin (), m_bnExpiry.end ());
+      m_bnExpiry.pop_back ();
+    }
+  if (m_expiry.empty () && m_bnExpiry.empty ())
+    {
+      m_ntimer.Cancel ();
+      return;
+    }
+  Time next;
+  if (m_expiry.empty ())
+    next = m_bnExpiry.front ().m_time;
+  else if (m_bnExpiry.empty ())
+    next = m_expiry.front ().m_time;
+  else
+    next = std::min (m_expiry.front ().m_time, m_bnExpiry.front ().m_time);
+  if (m_ntimer.IsRunning () && next == m_purgeTime)
+    return;
   m_ntimer.Cancel ();
-  m_ntimer.Schedule ();
+  m_purgeTime = next;
+  // An entry expires once its deadline is in the past, so wake up one step after it
+  m_ntimer.Schedule (std::max (m_purgeTime - Simulator::Now (), Time ()) + TimeStep (1));
 }
 
 void
@@ -505,15 +1006,70 @@ void
 Neighbors::ProcessTxError (WifiMacHeader const & hdr)
 {
 	NS_LOG_FUNCTION(this);
-  Mac48Address addr = hdr.GetAddr1 ();
-
-  for (NeighborSet::iterator i = localNeighborList.begin (); i != localNeighborList.end (); ++i)
+  const uint32_t * first = m_macIndex.Find (MacKey (hdr.GetAddr1 ()));
+  if (first == 0)
+    return;
+  for (uint32_t s = *first; s != 0xffffffff; s = m_macNext[s])
     {
-      if (i->m_hardwareAddress == addr)
-        i->close = true;
+      NeighborTuple & nt = m_tuples[s];
+      m_txErrors++;
+      // Joins the batch an earlier error of this time step started
+      if (nt.close || !m_txFailed.empty ())
+        m_txErrorsCoalesced++;
+      if (nt.close)
+        continue;
+      NS_LOG_INFO ("Link expired towards: " << nt);
+      nt.close = true;
+      Handle h;
+      h.m_slot = s;
+      h.m_generation = m_slots[s].m_generation;
+      m_txFailed.push_back (h);
     }
-  Purge ();
+  if (!m_txFailed.empty () && !m_txErrorTimer.IsRunning ())
+    m_txErrorTimer.Schedule ();
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for the hardware address of neighbors learned through ARP entries
+struct NeighborHardwareAddressTest : public TestCase
+{
+  NeighborHardwareAddressTest () : TestCase ("Neighbor hardware address"), nb (Seconds (1))
+  {}
+  virtual void DoRun ();
+
+  Neighbors nb;
+};
+
+void
+NeighborHardwareAddressTest::DoRun ()
+{
+  Ipv4Address addr ("10.0.0.2");
+  Mac48Address mac ("00:00:00:00:00:02");
+  Ptr<ArpCache> arp = CreateObject<ArpCache> ();
+  nb.AddArpCache (arp);
+  nb.Update (addr, Seconds (10));
+  NS_TEST_EXPECT_MSG_EQ (nb.FindNeighborTuple (addr)->m_hardwareAddress, Mac48Address (), "No ARP entry yet");
+
+  // Entry as RoutingProtocol::LearnHardwareAddress () installs it from a hello
+  ArpCache::Entry * entry = arp->Add (addr);
+  entry->SetMacAddresss (mac);
+  entry->UpdateSeen ();
+  nb.Update (addr, Seconds (10));
+  NS_TEST_EXPECT_MSG_EQ (nb.FindNeighborTuple (addr)->m_hardwareAddress, mac, "Hardware address of learned entry");
+
+  WifiMacHeader hdr;
+  hdr.SetAddr1 (mac);
+  nb.GetTxErrorCallback () (hdr);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetTxErrors (), 1, "Transmit error towards learned neighbor");
+
+  nb.DelArpCache (arp);
+  arp->Dispose ();
+  Simulator::Destroy ();
 }
+//-----------------------------------------------------------------------------
+
 }
 }
 
@@ -8,8 +8,13 @@
 #include "ns3/wifi-mac-header.h"
 #include "ns3/arp-cache.h"
 #include "aodv-packet.h"
+#include "aodv-flat-hash.h"
+#include "aodv-snapshot.h"
 #include <vector>
 #include <list>
+#include <deque>
+#include <iterator>
+#include <cstddef>
 
 namespace ns3
 {
@@ -204,10 +209,209 @@ class RoutingProtocol;
 /**
  * \ingroup aodv
  * \brief maintain list of active neighbors
+ *
+ * Neighbor tuples live in a slot map: a deque of tuples, an address to slot hash and the list of
+ * live slots in address order. Lookups by address are O(1). Slots of removed neighbors are reused.
+ * A pointer returned by FindNeighborTuple () stays valid until that neighbor is removed or the
+ * table is cleared, inserting other neighbors does not move it. A Handle also detects removal.
  */
 class Neighbors
 {
 public:
+	/// Stable reference to a neighbor tuple, see LookupHandle ()
+	struct Handle
+	{
+		Handle () : m_slot (0xffffffff), m_generation (0) {}
+		uint32_t m_slot;
+		uint32_t m_generation;
+	};
+	/**
+	 * Slot bookkeeping, the generation is bumped whenever the slot is released.
+	 * Status, client flag, weight and indicator mirror the tuple, so views filter without touching
+	 * the tuples and the status indexes know what to remove when the tuple changes.
+	 */
+	struct SlotState
+	{
+		SlotState () : m_generation (0), m_weight (0), m_used (false), m_status (0), m_client (false), m_indicator (0) {}
+		uint32_t m_generation;
+		uint32_t m_weight;
+		bool m_used;
+		uint8_t m_status;
+		bool m_client;
+		uint8_t m_indicator;
+	};
+
+	/**
+	 * Non-owning range over the live neighbors with one status, optionally clients only, in address order.
+	 * Valid until neighbors are added or removed or change status.
+	 */
+	class View
+	{
+	public:
+		class const_iterator
+		{
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef NeighborTuple value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef NeighborTuple * pointer;
+			typedef NeighborTuple & reference;
+			const_iterator (std::vector<uint32_t>::const_iterator pos, View const * view) : m_pos (pos), m_view (view) { Skip (); }
+			NeighborTuple & operator* () const { return (*m_view->m_tuples)[*m_pos]; }
+			NeighborTuple * operator-> () const { return &(*m_view->m_tuples)[*m_pos]; }
+			const_iterator & operator++ () { ++m_pos; Skip (); return *this; }
+			const_iterator operator++ (int) { const_iterator i = *this; ++*this; return i; }
+			bool operator== (const_iterator const & o) const { return m_pos == o.m_pos; }
+			bool operator!= (const_iterator const & o) const { return m_pos != o.m_pos; }
+		private:
+			void Skip () { while (m_pos != m_view->m_live->end () && !m_view->Match (*m_pos)) ++m_pos; }
+			std::vector<uint32_t>::const_iterator m_pos;
+			View const * m_view;
+		};
+		View (std::deque<NeighborTuple> * tuples, std::vector<SlotState> const * slots, std::vector<uint32_t> const * live,
+		      NodeStatus status, bool clients) :
+			m_tuples (tuples), m_slots (slots), m_live (live), m_status (status), m_clients (clients) {}
+		const_iterator begin () const { return const_iterator (m_live->begin (), this); }
+		const_iterator end () const { return const_iterator (m_live->end (), this); }
+		bool empty () const { return begin () == end (); }
+		uint32_t size () const { uint32_t n = 0; for (const_iterator i = begin (); i != end (); ++i) n++; return n; }
+	private:
+		bool Match (uint32_t slot) const
+		{
+			SlotState const & state = (*m_slots)[slot];
+			return state.m_status == m_status && (!m_clients || state.m_client);
+		}
+		std::deque<NeighborTuple> * m_tuples;
+		std::vector<SlotState> const * m_slots;
+		std::vector<uint32_t> const * m_live;
+		NodeStatus m_status;
+		bool m_clients;
+	};
+
+	/// Non-owning range over the common 2-hop BN neighbors of two neighbors, in address order
+	class CommonBnView
+	{
+	public:
+		class const_iterator
+		{
+		public:
+			/// Addresses are produced by value, so this is an input iterator
+			typedef std::input_iterator_tag iterator_category;
+			typedef Ipv4Address value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef Ipv4Address const * pointer;
+			typedef Ipv4Address reference;
+			const_iterator (CommonBnView const * view, uint32_t word) : m_view (view), m_word (word), m_bits (0) { Load (); }
+			Ipv4Address operator* () const
+			{
+				uint32_t bit = 0;
+				while (!((m_bits >> bit) & 1))
+					bit++;
+				return Ipv4Address ((*m_view->m_universe)[64 * m_word + bit]);
+			}
+			const_iterator & operator++ () { m_bits &= m_bits - 1; if (m_bits == 0) { m_word++; Load (); } return *this; }
+			const_iterator operator++ (int) { const_iterator i = *this; ++*this; return i; }
+			bool operator== (const_iterator const & o) const { return m_word == o.m_word && m_bits == o.m_bits; }
+			bool operator!= (const_iterator const & o) const { return !(*this == o); }
+		private:
+			/// Move to the next word with a common bit, at or after m_word
+			void Load ()
+			{
+				for (; m_word < m_view->m_words; ++m_word)
+					if ((m_bits = m_view->m_v[m_word] & m_view->m_w[m_word]) != 0)
+						return;
+			}
+			CommonBnView const * m_view;
+			uint32_t m_word;
+			uint64_t m_bits;
+		};
+		CommonBnView (const uint64_t * v, const uint64_t * w, uint32_t words, std::vector<uint32_t> const * universe) :
+			m_v (v), m_w (w), m_words (words), m_universe (universe) {}
+		const_iterator begin () const { return const_iterator (this, 0); }
+		const_iterator end () const { return const_iterator (this, m_words); }
+		bool empty () const { return begin () == end (); }
+	private:
+		const uint64_t * m_v;
+		const uint64_t * m_w;
+		uint32_t m_words;
+		std::vector<uint32_t> const * m_universe;
+	};
+
+	/**
+	 * Non-owning range over pairs of neighbors, without building a list. Over one view each unordered
+	 * pair of distinct neighbors is visited once, lower address first; over two views each pair
+	 * (v, w) with v in the first, w in the second and v != w. Valid as long as the views are.
+	 */
+	class PairView
+	{
+	public:
+		class const_iterator
+		{
+		public:
+			/// The current pair lives in the iterator, so this is an input iterator
+			typedef std::input_iterator_tag iterator_category;
+			typedef NeighborPair value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef NeighborPair const * pointer;
+			typedef NeighborPair const & reference;
+			const_iterator (PairView const * view, View::const_iterator first, View::const_iterator second) :
+				m_view (view), m_first (first), m_second (second) { Settle (); }
+			NeighborPair const & operator* () const { return m_pair; }
+			NeighborPair const * operator-> () const { return &m_pair; }
+			const_iterator & operator++ () { ++m_second; Settle (); return *this; }
+			const_iterator operator++ (int) { const_iterator i = *this; ++*this; return i; }
+			bool operator== (const_iterator const & o) const { return m_first == o.m_first && m_second == o.m_second; }
+			bool operator!= (const_iterator const & o) const { return !(*this == o); }
+		private:
+			/// Move to the next valid pair at or after the current position, or to end ()
+			void Settle ()
+			{
+				View::const_iterator firstEnd = m_view->m_one.end ();
+				View::const_iterator secondEnd = m_view->m_two.end ();
+				while (m_first != firstEnd)
+					{
+						if (m_second == secondEnd)
+							{
+								if (++m_first == firstEnd)
+									break;
+								m_second = m_view->Start (m_first);
+								continue;
+							}
+						if (m_first->neighborIfaceAddr != m_second->neighborIfaceAddr)
+							{
+								m_pair.neighborFirstIfaceAddr = m_first->neighborIfaceAddr;
+								m_pair.neighborSecondIfaceAddr = m_second->neighborIfaceAddr;
+								return;
+							}
+						++m_second;
+					}
+				m_second = secondEnd;
+			}
+			PairView const * m_view;
+			View::const_iterator m_first;
+			View::const_iterator m_second;
+			NeighborPair m_pair;
+		};
+		/// Unordered pairs of one
+		explicit PairView (View one) : m_one (one), m_two (one), m_unordered (true) {}
+		/// Pairs of one and two
+		PairView (View one, View two) : m_one (one), m_two (two), m_unordered (false) {}
+		const_iterator begin () const { View::const_iterator first = m_one.begin (); return const_iterator (this, first, Start (first)); }
+		const_iterator end () const { return const_iterator (this, m_one.end (), m_two.end ()); }
+		bool empty () const { return begin () == end (); }
+	private:
+		/// First candidate partner of first
+		View::const_iterator Start (View::const_iterator first) const
+		{
+			if (!m_unordered || first == m_one.end ())
+				return m_two.begin ();
+			return ++first;
+		}
+		View m_one;
+		View m_two;
+		bool m_unordered;
+	};
+
 	/// Constructor
 	Neighbors (Time delay);
 	/// Return expire time for neighbor node with address addr, if exists, else return 0.
@@ -216,14 +420,19 @@ public:
 	bool IsNeighbor (Ipv4Address addr);
 	/// Update expire time for entry with address addr, if it exists, else add new entry
 	void Update (Ipv4Address addr, Time expire);
-	/// Remove all expired entries
+	/**
+	 * Same as Update (), for the per packet path. A known neighbor with known hardware address
+	 * is refreshed in place with a single lookup and without purging.
+	 */
+	void Touch (Ipv4Address addr, Time expire);
+	/// Remove all expired entries, only the entries whose deadline passed are visited
 	void Purge ();
 	/// Remove all the entries with a few hello messages
 	void PurgeHello ();
-	/// Schedule m_ntimer.
+	/// Schedule m_ntimer at the next neighbor or 2-hop BN deadline
 	void ScheduleTimer ();
 	/// Remove all entries
-	void Clear () { localNeighborList.clear (); }
+	void Clear ();
 	/// Add ARP cache to be used to allow layer 2 notifications processing
 	void AddArpCache (Ptr<ArpCache>);
 	/// Don't use given ARP cache any more (interface is down)
@@ -233,10 +442,16 @@ public:
 
 	NeighborTuple* FindNeighborTuple (const Ipv4Address &mainAddr);
 	NeighborTuple* FindNeighborTuple (const Ipv4Address &mainAddr, NodeStatus nodeStatus);
+	/// Get a handle to neighbor addr. \return false if addr is not a neighbor
+	bool LookupHandle (Ipv4Address addr, Handle & handle) const;
+	/// \return the tuple referenced by handle, or 0 if that neighbor was removed since
+	NeighborTuple* GetTuple (Handle handle);
 	void EraseNeighborTuple (const NeighborTuple &neighborTuple);
 	void EraseNeighborTuple (const Ipv4Address &mainAddr);
 	void InsertNeighborTuple (const NeighborTuple &tuple);
 	void PrintLocalNeighborList();
+	/// Append all neighbors to snapshot record
+	void Snapshot (SnapshotWriter & writer);
 	void PrintMulticastNeighborList();
 	void PrintAddressSet(AddressSet set);
 
@@ -265,6 +480,24 @@ public:
 	
 	bool Are1HopNeighbors(const Ipv4Address &BNnode_v, const Ipv4Address &BNnode_w);
 	bool Are2HopNeighbors(const Ipv4Address &BNnode_v, const Ipv4Address &BNnode_w);
+	/// Same as !Intersection (GetMulticastNeighbors (neighbor), bn).empty (), one bit test
+	bool HasBnNeighbor (Ipv4Address neighbor, Ipv4Address bn);
+	/// Same as !Intersection (GetMulticastNeighbors (v), GetMulticastNeighbors (w)).empty (), a word-wise AND
+	bool HaveCommonBn (Ipv4Address v, Ipv4Address w);
+	/**
+	 * \name Neighbor table epoch
+	 *
+	 * The epoch changes when a neighbor is added or removed, changes status, or announces a
+	 * different 2-hop BN list. Hellos that only refresh timers keep it, so a predicate over
+	 * membership, status and adjacency computed in one epoch holds until the epoch changes.
+	 */
+	//\{
+	uint32_t GetEpoch () const { return m_epoch; }
+	/// \return dense index of neighbor below GetIndexCount (), 0xffffffff if unknown
+	uint32_t GetIndex (Ipv4Address neighbor) const { return FindSlot (neighbor); }
+	/// Bound of GetIndex (), fixed within an epoch
+	uint32_t GetIndexCount () const { return m_slots.size (); }
+	//\}
 	
 	bool AreNeighbors(NeighborPair hop_bn, Ipv4Address neighbor);
 	
@@ -278,13 +511,22 @@ public:
 	AddressSet GetMulticastNeighbors(Ipv4Address neighbor);
 	NeighborSet GetClients(NodeStatus nodeStatus);
 	NeighborSet GetClients();
+	///\name Zero-copy versions of GetOneHopNeighbors (), GetClients () and GetMulticastNeighbors ()
+	//\{
+	View GetOneHopNeighborView (NodeStatus nodeStatus)
+	{ return View (&m_tuples, &m_slots, &m_byStatus[GetBucket (nodeStatus)], nodeStatus, false); }
+	View GetClientView (NodeStatus nodeStatus)
+	{ return View (&m_tuples, &m_slots, &m_byStatus[GetBucket (nodeStatus)], nodeStatus, true); }
+	/// 2-hop BN list of a neighbor
+	MulticastBnNeighborSet const & GetBnNeighborList (Ipv4Address neighbor);
+	/// Same elements as GetCommonBN (), valid until the neighbor table changes
+	CommonBnView GetCommonBnView (NeighborPair bn_pair);
+	//\}
 		AddressSet GetCommonBN(NeighborPair gp);
 
 	bool HigherWeight(Ipv4Address neighbor);
 
 	bool HigherWeight(NeighborTuple *node);
-	
-	NeighborSet &GetNeighborList(){return localNeighborList;}
 
 	bool BCN2BNRule1();
 	bool BCN2BNRule2();
@@ -293,6 +535,22 @@ public:
   //\{
   void SetCallback (Callback<void, Ipv4Address> cb) { m_handleLinkFailure = cb; }
   Callback<void, Ipv4Address> GetCallback () const { return m_handleLinkFailure; }
+  /// Called once per purge with all the neighbors it removed, used instead of the per neighbor callback when set
+  void SetLinkFailuresCallback (Callback<void, std::vector<Ipv4Address> const &> cb) { m_handleLinkFailures = cb; }
+  //\}
+  /**
+   * \name Transmit error counters
+   *
+   * A MAC transmit error closes the neighbors with that hardware address. They are removed by one
+   * purge at the end of the time step, which also takes every other error of that step.
+   */
+  //\{
+  /// Transmit errors towards a known neighbor
+  uint64_t GetTxErrors () const { return m_txErrors; }
+  /// Transmit errors that joined a purge already pending
+  uint64_t GetTxErrorsCoalesced () const { return m_txErrorsCoalesced; }
+  /// Purges that removed neighbors closed by transmit errors
+  uint64_t GetTxErrorBatches () const { return m_txErrorBatches; }
   //\}
   static bool compare0IP (const Ipv4Address &a, const Ipv4Address &b)
   {
@@ -306,27 +564,230 @@ public:
   {
   return a.twoHopBnNeighborIfaceAddr.Get() < b.twoHopBnNeighborIfaceAddr.Get();
   }
-  /// BN Neighbor
-  std::list<NeighborTuple> localNeighborList;
 private:
   /// link failure callback
   Callback<void, Ipv4Address> m_handleLinkFailure;
+  /// Batch link failure callback
+  Callback<void, std::vector<Ipv4Address> const &> m_handleLinkFailures;
+  /// Whether some link failure callback is set
+  bool HasLinkFailureCallback () const { return !m_handleLinkFailures.IsNull () || !m_handleLinkFailure.IsNull (); }
   /// TX error callback
   Callback<void, WifiMacHeader const &> m_txErrorCallback;
   /// Timer for neighbor's list. Schedule Purge().
   Timer m_ntimer;
+  /// Deadline m_ntimer is scheduled for
+  Time m_purgeTime;
   int32_t m_minHello;
   Time m_shortTimer;
   Time m_longTimer;
   /// list of ARP cached to be used for layer 2 notifications processing
   std::vector<Ptr<ArpCache> > m_arp;
 
+  ///\name Slot map of neighbor tuples
+  //\{
+  /// Tuples by slot, released slots hold a blank tuple
+  std::deque<NeighborTuple> m_tuples;
+  /// State of each slot
+  std::vector<SlotState> m_slots;
+  /// Released slots, reused before the deque grows
+  std::vector<uint32_t> m_freeSlots;
+  /// Live slots in neighbor address order
+  std::vector<uint32_t> m_live;
+  /// Neighbor address to slot
+  FlatHashMap<uint32_t> m_index;
+  /// \return slot of neighbor addr, 0xffffffff if none
+  uint32_t FindSlot (Ipv4Address addr) const;
+  /// Store tuple in a free slot and insert it in the live list. \return the slot
+  uint32_t AddTuple (NeighborTuple const & tuple);
+  /// Release slot, the caller removes it from the live list
+  void ReleaseSlot (uint32_t slot);
+  /// Release a batch of slots and compact the live list once
+  void ReleaseSlots (std::vector<uint32_t> const & slots);
+  /// Remove slot from the live list and release it
+  void EraseSlot (uint32_t slot);
+  /// Slots found dead by Purge () and PurgeHello (), kept to reuse its capacity
+  std::vector<uint32_t> m_dead;
+  /// Addresses of the removed neighbors, passed to the link failure callback
+  std::vector<Ipv4Address> m_failed;
+  /// Release the slots in m_dead, then report their neighbors to the link failure callback
+  void RemoveDead ();
+  /// Hardware address to the first slot with it, see m_macNext
+  FlatHashMap<uint32_t> m_macIndex;
+  /// By slot, next slot with the same hardware address, 0xffffffff at the end
+  std::vector<uint32_t> m_macNext;
+  /// Add slot to m_macIndex, if its hardware address is known
+  void IndexMac (uint32_t slot);
+  /// Remove slot from m_macIndex
+  void UnindexMac (uint32_t slot);
+  /// Neighbors closed by transmit errors since the last purge
+  std::vector<Handle> m_txFailed;
+  /// Purge at the end of the time step of a transmit error
+  Timer m_txErrorTimer;
+  uint64_t m_txErrors;
+  uint64_t m_txErrorsCoalesced;
+  uint64_t m_txErrorBatches;
+  //\}
+
+  /**
+   * \name Expiry
+   *
+   * Min-heaps of deadlines: one for the neighbor tuples and one for the earliest 2-hop BN timeout of
+   * each neighbor. Refreshing a neighbor does not touch its heap entry; when that entry comes due the
+   * neighbor is requeued at its current expire time. Entries of released slots are stale by generation.
+   */
+  //\{
+  /// Deadline of a slot
+  struct Deadline
+  {
+    Time m_time;
+    uint32_t m_slot;
+    uint32_t m_generation;
+    /// Reversed, so that std heap algorithms keep the earliest deadline on top
+    bool operator< (Deadline const & o) const { return m_time > o.m_time; }
+  };
+  /// Neighbor expire times
+  std::vector<Deadline> m_expiry;
+  /// Earliest 2-hop BN timeout per neighbor
+  std::vector<Deadline> m_bnExpiry;
+  /// By slot, the 2-hop BN deadline queued in m_bnExpiry, older entries of the slot are stale
+  std::vector<Time> m_bnDeadlines;
+  /// Queue a deadline of slot in heap and move the timer earlier if needed
+  void PushExpiry (std::vector<Deadline> & heap, Time time, uint32_t slot);
+  /// Queue the earliest 2-hop BN timeout of slot, unless already queued
+  void ScheduleBnExpiry (uint32_t slot);
+  /// Whether d still refers to its slot, bn for entries of m_bnExpiry
+  bool IsCurrent (Deadline const & d, bool bn) const;
+  /// Drop the stale entries of heap
+  void CompactExpiry (std::vector<Deadline> & heap);
+  /// Append the expired neighbors to m_dead and drop the expired 2-hop BN neighbors
+  void CollectExpired ();
+  //\}
+
+  /**
+   * \name Neighbors by status
+   *
+   * Live slots are also kept per status (RN, BCN, BN, bucket 0 for anything else), so counts are
+   * O(1) and views visit only their status. Each status also keeps its neighbors ordered by weight,
+   * indicator and address, from which GetBestNeighbor () picks with a few binary searches.
+   */
+  //\{
+  /// Ordering key of a neighbor for GetBestNeighbor ()
+  struct BestKey
+  {
+    /// Class of CONVERT_BREAK neighbors, above every other indicator
+    static const uint16_t BREAK = 0x100;
+    uint32_t m_weight;
+    /// Indicator, BREAK for CONVERT_BREAK
+    uint16_t m_class;
+    uint32_t m_address;
+    bool operator< (BestKey const & o) const
+    {
+      if (m_weight != o.m_weight)
+        return m_weight < o.m_weight;
+      if (m_class != o.m_class)
+        return m_class < o.m_class;
+      return m_address < o.m_address;
+    }
+  };
+  /// Live slots per status bucket, in neighbor address order
+  std::vector<uint32_t> m_byStatus[4];
+  /// Keys of the live neighbors per status bucket, sorted
+  std::vector<BestKey> m_best[4];
+  /// \return the bucket of status
+  static uint32_t GetBucket (uint32_t status);
+  /// Key of slot, from its mirrored state
+  BestKey GetBestKey (uint32_t slot) const;
+  /// Mirror the tuple of slot in its SlotState, then add slot to the indexes of its status
+  void IndexStatus (uint32_t slot);
+  /// Remove slot from the indexes of its mirrored status
+  void UnindexStatus (uint32_t slot);
+  /// \return the address GetBestNeighbor () picks from keys, not empty
+  static uint32_t GetBestAddress (std::vector<BestKey> const & keys);
+  //\}
+
+  /**
+   * \name 2-hop BN adjacency as bitsets
+   *
+   * The addresses of all 1-hop and 2-hop BN neighbors are numbered in address order, and the 2-hop
+   * BN list of each neighbor is a row of m_bnWords words over that numbering. The index is rebuilt
+   * on the first query after the neighbor table changed, so in practice once per long timer.
+   */
+  //\{
+  /// Known addresses, sorted; the bit of an address is its position
+  std::vector<uint32_t> m_universe;
+  /// Address to bit
+  FlatHashMap<uint32_t> m_universeIndex;
+  /// One row per slot
+  std::vector<uint64_t> m_bnBits;
+  /// Words per row
+  uint32_t m_bnWords;
+  /// False when the neighbor table changed after the last build
+  bool m_adjacencyValid;
+  /// See GetEpoch ()
+  uint32_t m_epoch;
+  /// Invalidate the adjacency and start a new epoch
+  void TopologyChanged () { m_adjacencyValid = false; m_epoch++; }
+  /// Rebuild the universe and the rows
+  void BuildAdjacency ();
+  /// \return the row of neighbor, rebuilding the index if needed
+  const uint64_t * GetBnRow (Ipv4Address neighbor);
+  //\}
+
   /// Find MAC address by IP using list of ARP caches
   Mac48Address LookupMacAddress (Ipv4Address);
   /// Process layer 2 TX error notification
   void ProcessTxError (WifiMacHeader const &);
 };
 
+/**
+ * \ingroup aodv
+ * \brief Memo of a symmetric or ordered predicate over pairs of neighbors
+ *
+ * Results are kept in a table indexed by Neighbors::GetIndex () and dropped as soon as the
+ * epoch of the neighbor table changes, so only predicates over membership, status and 2-hop
+ * adjacency may be stored. The table costs one byte per pair of slots.
+ */
+class PairMemo
+{
+public:
+  PairMemo () : m_epoch (0), m_count (0) {}
+  /// \return true and set value if the pair (v, w) is known in the current epoch of nb
+  bool Find (Neighbors const & nb, Ipv4Address v, Ipv4Address w, bool & value)
+  {
+    uint8_t const * cell = Cell (nb, v, w);
+    if (!cell || *cell == PAIR_UNKNOWN)
+      return false;
+    value = *cell == PAIR_TRUE;
+    return true;
+  }
+  /// Store value for the pair (v, w)
+  void Insert (Neighbors const & nb, Ipv4Address v, Ipv4Address w, bool value)
+  {
+    uint8_t * cell = Cell (nb, v, w);
+    if (cell)
+      *cell = value ? PAIR_TRUE : PAIR_FALSE;
+  }
+private:
+  enum Value { PAIR_UNKNOWN = 0, PAIR_FALSE = 1, PAIR_TRUE = 2 };
+  uint32_t m_epoch;
+  uint32_t m_count;
+  std::vector<uint8_t> m_cells;
+  uint8_t * Cell (Neighbors const & nb, Ipv4Address v, Ipv4Address w)
+  {
+    if (m_epoch != nb.GetEpoch () || m_count != nb.GetIndexCount ())
+      {
+        m_epoch = nb.GetEpoch ();
+        m_count = nb.GetIndexCount ();
+        m_cells.assign (m_count * m_count, PAIR_UNKNOWN);
+      }
+    uint32_t i = nb.GetIndex (v);
+    uint32_t j = nb.GetIndex (w);
+    if (i == 0xffffffff || j == 0xffffffff)
+      return 0;
+    return &m_cells[i * m_count + j];
+  }
+};
+
 }
 }
 #endif /* __AODV_NEIGHBOR_H__ */
@@ -0,0 +1,201 @@
+#include "aodv-precursor-set.h"
+#include <algorithm>
+#include "ns3/test.h"
+
+namespace ns3
+{
+namespace aodvmesh
+{
+PrecursorSet::PrecursorSet (PrecursorSet const & o) :
+  m_size (o.m_size), m_spill (0)
+{
+  if (o.m_spill)
+    m_spill = new FlatHashMap<bool> (*o.m_spill);
+  else
+    std::copy (o.m_inline, o.m_inline + o.m_size, m_inline);
+}
+
+PrecursorSet &
+PrecursorSet::operator= (PrecursorSet const & o)
+{
+  if (this == &o)
+    return *this;
+  if (o.m_spill)
+    {
+      if (m_spill)
+        *m_spill = *o.m_spill;
+      else
+        m_spill = new FlatHashMap<bool> (*o.m_spill);
+    }
+  else
+    {
+      delete m_spill;
+      m_spill = 0;
+      std::copy (o.m_inline, o.m_inline + o.m_size, m_inline);
+    }
+  m_size = o.m_size;
+  return *this;
+}
+
+PrecursorSet::~PrecursorSet ()
+{
+  delete m_spill;
+}
+
+bool
+PrecursorSet::Insert (Ipv4Address addr)
+{
+  uint32_t key = addr.Get ();
+  if (m_spill)
+    {
+      bool inserted;
+      m_spill->Insert (key, true, &inserted);
+      if (inserted)
+        m_size++;
+      return inserted;
+    }
+  for (uint32_t i = 0; i < m_size; ++i)
+    if (m_inline[i] == key)
+      return false;
+  if (m_size < INLINE_SIZE)
+    {
+      m_inline[m_size++] = key;
+      return true;
+    }
+  m_spill = new FlatHashMap<bool> ();
+  for (uint32_t i = 0; i < m_size; ++i)
+    m_spill->Insert (m_inline[i], true);
+  m_spill->Insert (key, true);
+  m_size++;
+  return true;
+}
+
+bool
+PrecursorSet::Contains (Ipv4Address addr) const
+{
+  uint32_t key = addr.Get ();
+  if (m_spill)
+    return m_spill->Find (key) != 0;
+  for (uint32_t i = 0; i < m_size; ++i)
+    if (m_inline[i] == key)
+      return true;
+  return false;
+}
+
+bool
+PrecursorSet::Erase (Ipv4Address addr)
+{
+  uint32_t key = addr.Get ();
+  if (m_spill)
+    {
+      if (!m_spill->Erase (key))
+        return false;
+      m_size--;
+      if (m_size == INLINE_SIZE)
+        {
+          uint32_t n = 0;
+          for (uint32_t i = 0; i < m_spill->GetCapacity (); ++i)
+            if (m_spill->IsUsed (i))
+              m_inline[n++] = m_spill->GetKey (i);
+          delete m_spill;
+          m_spill = 0;
+        }
+      return true;
+    }
+  for (uint32_t i = 0; i < m_size; ++i)
+    if (m_inline[i] == key)
+      {
+        // Keep insertion order of the remaining addresses
+        std::copy (m_inline + i + 1, m_inline + m_size, m_inline + i);
+        m_size--;
+        return true;
+      }
+  return false;
+}
+
+void
+PrecursorSet::Clear ()
+{
+  delete m_spill;
+  m_spill = 0;
+  m_size = 0;
+}
+
+void
+PrecursorSet::Union (PrecursorSet const & o)
+{
+  if (o.m_spill)
+    {
+      for (uint32_t i = 0; i < o.m_spill->GetCapacity (); ++i)
+        if (o.m_spill->IsUsed (i))
+          Insert (Ipv4Address (o.m_spill->GetKey (i)));
+    }
+  else
+    {
+      for (uint32_t i = 0; i < o.m_size; ++i)
+        Insert (Ipv4Address (o.m_inline[i]));
+    }
+}
+
+void
+PrecursorSet::GetAddresses (std::vector<Ipv4Address> & v) const
+{
+  if (m_spill)
+    {
+      for (uint32_t i = 0; i < m_spill->GetCapacity (); ++i)
+        if (m_spill->IsUsed (i))
+          v.push_back (Ipv4Address (m_spill->GetKey (i)));
+    }
+  else
+    {
+      for (uint32_t i = 0; i < m_size; ++i)
+        v.push_back (Ipv4Address (m_inline[i]));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for precursor set
+struct PrecursorSetTest : public TestCase
+{
+  PrecursorSetTest () : TestCase ("Precursor set")
+  {}
+  virtual void DoRun ();
+};
+
+void
+PrecursorSetTest::DoRun ()
+{
+  PrecursorSet s;
+  NS_TEST_EXPECT_MSG_EQ (s.IsEmpty (), true, "trivial");
+  NS_TEST_EXPECT_MSG_EQ (s.Insert (Ipv4Address ("1.1.1.1")), true, "New precursor");
+  NS_TEST_EXPECT_MSG_EQ (s.Insert (Ipv4Address ("1.1.1.1")), false, "Known precursor");
+  for (uint32_t i = 2; i <= 10; ++i)
+    s.Insert (Ipv4Address (i));
+  NS_TEST_EXPECT_MSG_EQ (s.GetSize (), 10, "Spilled set");
+  NS_TEST_EXPECT_MSG_EQ (s.Contains (Ipv4Address (7)), true, "Lookup in spilled set");
+  NS_TEST_EXPECT_MSG_EQ (s.Insert (Ipv4Address (7)), false, "Known precursor in spilled set");
+  PrecursorSet copy (s);
+  for (uint32_t i = 2; i <= 7; ++i)
+    s.Erase (Ipv4Address (i));
+  NS_TEST_EXPECT_MSG_EQ (s.GetSize (), 4, "Back in place");
+  NS_TEST_EXPECT_MSG_EQ (s.Contains (Ipv4Address ("1.1.1.1")), true, "Kept when moved back in place");
+  NS_TEST_EXPECT_MSG_EQ (s.Contains (Ipv4Address (5)), false, "Erased precursor");
+  NS_TEST_EXPECT_MSG_EQ (copy.GetSize (), 10, "Copy is independent");
+
+  PrecursorSet u;
+  u.Insert (Ipv4Address (11));
+  u.Insert (Ipv4Address (9));
+  std::vector<Ipv4Address> v;
+  u.GetAddresses (v);
+  NS_TEST_EXPECT_MSG_EQ (v.front (), Ipv4Address (11), "Insertion order in place");
+  u.Union (s);
+  v.clear ();
+  u.GetAddresses (v);
+  NS_TEST_EXPECT_MSG_EQ (v.size (), 5, "Union without duplicates");
+}
+//-----------------------------------------------------------------------------
+
+}
+}
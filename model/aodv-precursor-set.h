@@ -0,0 +1,59 @@
+#ifndef __AODV_PRECURSOR_SET_H__
+#define __AODV_PRECURSOR_SET_H__
+
+#include <stdint.h>
+#include <vector>
+#include "ns3/ipv4-address.h"
+#include "aodv-flat-hash.h"
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/**
+ * \ingroup aodv
+ *
+ * \brief Set of precursor addresses of a route.
+ *
+ * Up to INLINE_SIZE addresses are kept in place, in insertion order, so the common
+ * case of a few precursors needs no heap memory and copies with the routing table entry
+ * at the cost of a few words. Larger sets spill to a hash set and move back in place
+ * once they shrink to INLINE_SIZE.
+ */
+class PrecursorSet
+{
+public:
+  /// c-tor
+  PrecursorSet () : m_size (0), m_spill (0) {}
+  PrecursorSet (PrecursorSet const & o);
+  PrecursorSet & operator= (PrecursorSet const & o);
+  ~PrecursorSet ();
+  /// Insert address. \return true if it was not in the set
+  bool Insert (Ipv4Address addr);
+  /// \return true if address is in the set
+  bool Contains (Ipv4Address addr) const;
+  /// Remove address. \return true if it was in the set
+  bool Erase (Ipv4Address addr);
+  /// Remove all addresses
+  void Clear ();
+  /// Insert all addresses of o
+  void Union (PrecursorSet const & o);
+  /// Append the addresses to v
+  void GetAddresses (std::vector<Ipv4Address> & v) const;
+  uint32_t GetSize () const { return m_size; }
+  bool IsEmpty () const { return m_size == 0; }
+private:
+  /// Largest set kept in place
+  static const uint32_t INLINE_SIZE = 4;
+  /// Number of addresses
+  uint32_t m_size;
+  /// Addresses, valid while m_spill is 0
+  uint32_t m_inline[INLINE_SIZE];
+  /// Addresses of large sets
+  FlatHashMap<bool> * m_spill;
+};
+
+}
+}
+
+#endif /* __AODV_PRECURSOR_SET_H__ */
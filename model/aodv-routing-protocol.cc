@@ -4,12 +4,14 @@
 #include "aodv-routing-protocol.h"
 #include "ns3/log.h"
 #include "ns3/boolean.h"
+#include "ns3/double.h"
 #include "ns3/random-variable-stream.h"
 #include "ns3/inet-socket-address.h"
 #include "ns3/trace-source-accessor.h"
 #include "ns3/udp-socket-factory.h"
 #include "ns3/wifi-net-device.h"
 #include "ns3/adhoc-wifi-mac.h"
+#include "ns3/udp-l4-protocol.h"
 #include "ns3/string.h"
 #include "ns3/pointer.h"
 #include <algorithm>
@@ -90,10 +92,17 @@ RoutingProtocol::RoutingProtocol () :
   DestinationOnly (false),
   GratuitousReply (true),
   EnableHello (true),
+  DpdMemory (65536),
+  DpdFalsePositiveRate (0.001),
+  QueueDrainInterval (Seconds (0)),
+  LearnArpFromControl (false),
+  SnapshotInterval (Seconds (0)),
   m_routingTable (DeletePeriod),
   m_queue (MaxQueueLen, MaxQueueTime),
   m_requestId (0),
   m_seqNo (0),
+  m_arpLearned (0),
+  m_arpRefreshed (0),
   m_rreqIdCache (PathDiscoveryTime),
   m_dpd (PathDiscoveryTime),
   m_nb (Seconds(LONG_INTERVAL)),
@@ -114,11 +123,14 @@ RoutingProtocol::RoutingProtocol () :
   Rule2(true),
   m_htimer (Timer::CANCEL_ON_DESTROY),
   m_ltimer (Timer::CANCEL_ON_DESTROY),
-  m_rreqRateLimitTimer (Timer::CANCEL_ON_DESTROY)
+  m_rreqRateLimitTimer (Timer::CANCEL_ON_DESTROY),
+  m_snapshotTimer (Timer::CANCEL_ON_DESTROY)
   {
+	m_queue.SetDropCallback (MakeCallback (&RoutingProtocol::NotifyQueueDrop, this));
 	if (EnableHello)
 	{
 	  m_nb.SetCallback (MakeCallback (&RoutingProtocol::SendRerrWhenBreaksLinkToNextHop, this));
+	  m_nb.SetLinkFailuresCallback (MakeCallback (&RoutingProtocol::SendRerrWhenBreaksLinksToNextHops, this));
 	}
   }
 
@@ -199,6 +211,31 @@ RoutingProtocol::GetTypeId (void)
                    MakeTimeAccessor (&RoutingProtocol::SetMaxQueueTime,
                                      &RoutingProtocol::GetMaxQueueTime),
                    MakeTimeChecker ())
+    .AddAttribute ("MaxQueueBytes", "Maximum number of bytes that we allow a routing protocol to buffer, 0 for no byte limit.",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&RoutingProtocol::SetMaxQueueBytes,
+                                         &RoutingProtocol::GetMaxQueueBytes),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("QueueWeightBackground", "Weight of the background class (ToS precedence 1, 2) in request queue eviction.",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&RoutingProtocol::SetQueueWeightBackground,
+                                         &RoutingProtocol::GetQueueWeightBackground),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("QueueWeightBestEffort", "Weight of the best effort class (ToS precedence 0, 3) in request queue eviction.",
+                   UintegerValue (2),
+                   MakeUintegerAccessor (&RoutingProtocol::SetQueueWeightBestEffort,
+                                         &RoutingProtocol::GetQueueWeightBestEffort),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("QueueWeightVideo", "Weight of the video class (ToS precedence 4, 5) in request queue eviction.",
+                   UintegerValue (4),
+                   MakeUintegerAccessor (&RoutingProtocol::SetQueueWeightVideo,
+                                         &RoutingProtocol::GetQueueWeightVideo),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("QueueWeightVoice", "Weight of the voice class (ToS precedence 6, 7) in request queue eviction.",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&RoutingProtocol::SetQueueWeightVoice,
+                                         &RoutingProtocol::GetQueueWeightVoice),
+                   MakeUintegerChecker<uint32_t> (1))
     .AddAttribute ("AllowedHelloLoss", "Number of hello messages which may be loss for valid link.",
                    UintegerValue (1),
                    MakeUintegerAccessor (&RoutingProtocol::AllowedHelloLoss),
@@ -223,6 +260,35 @@ RoutingProtocol::GetTypeId (void)
                    MakeBooleanAccessor (&RoutingProtocol::SetBroadcastEnable,
                                         &RoutingProtocol::GetBroadcastEnable),
                    MakeBooleanChecker ())
+    .AddAttribute ("DuplicateDetectionMode", "Duplicate detection of broadcast data packets: exact cache or bounded memory Bloom filters.",
+                   EnumValue (DuplicatePacketDetection::EXACT),
+                   MakeEnumAccessor (&RoutingProtocol::SetDuplicateDetectionMode,
+                                     &RoutingProtocol::GetDuplicateDetectionMode),
+                   MakeEnumChecker (DuplicatePacketDetection::EXACT, "Exact",
+                                    DuplicatePacketDetection::BLOOM, "Bloom"))
+    .AddAttribute ("DuplicateDetectionMemory", "Memory budget (bytes) of the duplicate detection filters in Bloom mode.",
+                   UintegerValue (65536),
+                   MakeUintegerAccessor (&RoutingProtocol::SetDuplicateDetectionMemory,
+                                         &RoutingProtocol::GetDuplicateDetectionMemory),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("DuplicateDetectionFalsePositiveRate", "Target false positive rate of duplicate detection in Bloom mode.",
+                   DoubleValue (0.001),
+                   MakeDoubleAccessor (&RoutingProtocol::SetDuplicateDetectionFalsePositiveRate,
+                                       &RoutingProtocol::GetDuplicateDetectionFalsePositiveRate),
+                   MakeDoubleChecker<double> (0, 0.5))
+    .AddAttribute ("QueueDrainInterval", "Gap between packets released from the request queue once a route is found, zero sends them all at once.",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&RoutingProtocol::QueueDrainInterval),
+                   MakeTimeChecker ())
+    .AddAttribute ("LearnArpFromControl", "Install or refresh ARP entries from the source hardware address of received hello and RREQ frames.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&RoutingProtocol::LearnArpFromControl),
+                   MakeBooleanChecker ())
+    .AddAttribute ("SnapshotInterval", "Interval between binary snapshots written to the stream given to SetSnapshotStream, zero disables them.",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&RoutingProtocol::SetSnapshotInterval,
+                                     &RoutingProtocol::GetSnapshotInterval),
+                   MakeTimeChecker ())
 	  .AddAttribute ("Rule1", "Indicates whether the BCN-to-BN conversion rule 1 is applied or not.",
 					 BooleanValue (true),
 					 MakeBooleanAccessor (&RoutingProtocol::SetRule1,
@@ -280,6 +346,10 @@ RoutingProtocol::GetTypeId (void)
     .AddTraceSource ("Rx", "A new routing protocol packet is received", // trace
                      MakeTraceSourceAccessor (&RoutingProtocol::m_rxTrace),
                      "ns3::Packet::TracedCallback")
+    .AddTraceSource ("QueueDrop", "A packet was dropped from the request queue: packet, traffic class (0 background, 1 best effort, 2 video, 3 voice)",
+                     MakeTraceSourceAccessor (&RoutingProtocol::m_queueDropTrace))
+    .AddTraceSource ("QueueDrain", "Queued packets were released for a destination: destination, burst size, drain duration",
+                     MakeTraceSourceAccessor (&RoutingProtocol::m_queueDrainTrace))
 .AddAttribute ("IsMalicious", "Is the node malicious",
                    BooleanValue (false),
                    MakeBooleanAccessor (&RoutingProtocol::SetMaliciousEnable,
@@ -310,6 +380,20 @@ RoutingProtocol::SetMaxQueueTime (Time t)
   m_queue.SetQueueTimeout (t);
 }
 
+void
+RoutingProtocol::SetDuplicateDetectionMemory (uint32_t bytes)
+{
+  DpdMemory = bytes;
+  m_dpd.SetFilterParameters (DpdMemory, DpdFalsePositiveRate);
+}
+
+void
+RoutingProtocol::SetDuplicateDetectionFalsePositiveRate (double rate)
+{
+  DpdFalsePositiveRate = rate;
+  m_dpd.SetFilterParameters (DpdMemory, DpdFalsePositiveRate);
+}
+
 RoutingProtocol::~RoutingProtocol ()
 {
 }
@@ -317,6 +401,11 @@ RoutingProtocol::~RoutingProtocol ()
 void
 RoutingProtocol::DoDispose ()
 {
+  if (!m_arpLearningDevices.empty ())
+    {
+      m_ipv4->GetObject<Node> ()->UnregisterProtocolHandler (MakeCallback (&RoutingProtocol::LearnHardwareAddress, this));
+      m_arpLearningDevices.clear ();
+    }
   m_ipv4 = 0;
   for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::iterator iter =
          m_socketAddresses.begin (); iter != m_socketAddresses.end (); iter++)
@@ -325,6 +414,11 @@ RoutingProtocol::DoDispose ()
     }
   GetLocalState();
   m_nb.Purge();
+  for (std::vector<EventId>::iterator i = m_pacedEvents.begin (); i != m_pacedEvents.end (); ++i)
+    i->Cancel ();
+  m_pacedEvents.clear ();
+  m_snapshotTimer.Cancel ();
+  m_snapshotStream = 0;
   m_socketAddresses.clear ();
   Ipv4RoutingProtocol::DoDispose ();
 }
@@ -336,6 +430,49 @@ RoutingProtocol::PrintRoutingTable (Ptr<OutputStreamWrapper> stream) const
   m_routingTable.Print (stream);
 }
 
+void
+RoutingProtocol::WriteSnapshot (Ptr<OutputStreamWrapper> stream)
+{
+  NS_LOG_FUNCTION (this);
+  m_snapshot.Begin (m_ipv4->GetObject<Node> ()->GetId (), m_mainAddress.Get (), Simulator::Now ().GetNanoSeconds ());
+  m_routingTable.Snapshot (m_snapshot);
+  m_nb.Snapshot (m_snapshot);
+  char const * record = m_snapshot.Finish ();
+  stream->GetStream ()->write (record, m_snapshot.GetSize ());
+}
+
+void
+RoutingProtocol::SetSnapshotStream (Ptr<OutputStreamWrapper> stream)
+{
+  m_snapshotStream = stream;
+  ScheduleSnapshots ();
+}
+
+void
+RoutingProtocol::SetSnapshotInterval (Time t)
+{
+  SnapshotInterval = t;
+  ScheduleSnapshots ();
+}
+
+void
+RoutingProtocol::ScheduleSnapshots ()
+{
+  m_snapshotTimer.Cancel ();
+  // Started by Start () when the attribute and the stream are set before the protocol has its node
+  if (m_ipv4 == 0 || m_snapshotStream == 0 || !SnapshotInterval.IsStrictlyPositive ())
+    return;
+  m_snapshotTimer.SetFunction (&RoutingProtocol::SnapshotTimerExpire, this);
+  m_snapshotTimer.Schedule (SnapshotInterval);
+}
+
+void
+RoutingProtocol::SnapshotTimerExpire ()
+{
+  WriteSnapshot (m_snapshotStream);
+  m_snapshotTimer.Schedule (SnapshotInterval);
+}
+
 void
 RoutingProtocol::GetLocalState ()
 {
@@ -367,6 +504,7 @@ RoutingProtocol::Start ()
   m_rerrRateLimitTimer.SetFunction (&RoutingProtocol::RerrRateLimitTimerExpire,
                                     this);
   m_rerrRateLimitTimer.Schedule (Seconds (1));
+  ScheduleSnapshots ();
 
   m_messageSequenceNumber = m_uniformRandomVariable->GetInteger (99, 91199);
   m_nb.SetMinHello(AllowedHelloLoss);
@@ -402,12 +540,12 @@ RoutingProtocol::RouteOutput (Ptr<Packet> p, const Ipv4Header &header,
 	  NS_LOG_LOGIC ("aodv: No multicast routing protocol");
 	  return route;
   }
-  RoutingTableEntry rt;
-  if (m_routingTable.LookupValidRoute (dst, rt))
+  RoutingTableEntry * rt = m_routingTable.LookupValidRoute (dst);
+  if (rt)
     {
-      route = rt.GetRoute ();
+      route = rt->GetRoute ();
       NS_ASSERT (route != 0);
-      NS_LOG_DEBUG ("Exist route to " << route->GetDestination () << " from interface " << route->GetSource ());
+      NS_LOG_DEBUG ("Exist route to " << dst << " from interface " << route->GetSource ());
       if (oif != 0 && route->GetOutputDevice () != oif)
         {
           NS_LOG_DEBUG ("Output device doesn't match. Dropped.");
@@ -443,9 +581,8 @@ RoutingProtocol::DeferredRouteOutput (Ptr<const Packet> p, const Ipv4Header & he
   if (result)
     {
       NS_LOG_LOGIC ("Add packet " << p->GetUid () << " to queue. Protocol " << (uint16_t) header.GetProtocol ());
-      RoutingTableEntry rt;
-      bool result = m_routingTable.LookupRoute (header.GetDestination (), rt);
-      if(!result || ((rt.GetFlag () != IN_SEARCH) && result))
+      RoutingTableEntry * rt = m_routingTable.LookupRoute (header.GetDestination ());
+      if (!rt || rt->GetFlag () != IN_SEARCH)
         {
           NS_LOG_LOGIC ("Send new RREQ for outbound packet to " <<header.GetDestination ());
           SendRequest (header.GetDestination ());
@@ -527,10 +664,10 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p, const Ipv4Header &header,
             if (header.GetTtl () > 1)
               {
                 NS_LOG_LOGIC ("Forward broadcast. TTL " << (uint16_t) header.GetTtl ());
-                RoutingTableEntry toBroadcast;
-                if (m_routingTable.LookupRoute (dst, toBroadcast))
+                RoutingTableEntry * toBroadcast = m_routingTable.LookupRoute (dst);
+                if (toBroadcast)
                   {
-                    Ptr<Ipv4Route> route = toBroadcast.GetRoute ();
+                    Ptr<Ipv4Route> route = toBroadcast->GetRoute ();
                     ucb (route, packet, header);
                   }
                 else
@@ -550,11 +687,12 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p, const Ipv4Header &header,
   if (m_ipv4->IsDestinationAddress (dst, iif))
     {
       UpdateRouteLifeTime (origin, ActiveRouteTimeout);
-      RoutingTableEntry toOrigin;
-      if (m_routingTable.LookupValidRoute (origin, toOrigin))
+      RoutingTableEntry * toOrigin = m_routingTable.LookupValidRoute (origin);
+      if (toOrigin)
         {
-          UpdateRouteLifeTime (toOrigin.GetNextHop (), ActiveRouteTimeout);
-          m_nb.Update (toOrigin.GetNextHop (), ActiveRouteTimeout);
+          Ipv4Address prevHop = toOrigin->GetNextHop ();
+          UpdateRouteLifeTime (prevHop, ActiveRouteTimeout);
+          m_nb.Touch (prevHop, ActiveRouteTimeout);
         }
       if (lcb.IsNull () == false)
         {
@@ -580,18 +718,20 @@ RoutingProtocol::Forwarding (Ptr<const Packet> p, const Ipv4Header & header,
   NS_LOG_FUNCTION (this);
   Ipv4Address dst = header.GetDestination ();
   Ipv4Address origin = header.GetSource ();
-  m_routingTable.Purge ();
-  RoutingTableEntry toDst;
  if(IsMalicious)
           {//When malicious node receives packet it drops the packet.
                 std :: cout <<"Launching Blackhole Attack! Packet dropped . . . \n";
                return false; 
           }
-  if (m_routingTable.LookupRoute (dst, toDst))
+  // A stable route is served by the route cache, without purging the table
+  RoutingTableEntry * toDst = m_routingTable.LookupCachedRoute (dst);
+  if (!toDst)
+    toDst = m_routingTable.LookupRoute (dst);
+  if (toDst)
     {
-      if (toDst.GetFlag () == VALID)
+      if (toDst->GetFlag () == VALID)
         {
-          Ptr<Ipv4Route> route = toDst.GetRoute ();
+          Ptr<Ipv4Route> route = toDst->GetRoute ();
           NS_LOG_LOGIC (route->GetSource ()<<" forwarding to " << dst << " from " << origin << " packet " << p->GetUid ());
 
           /*
@@ -600,29 +740,34 @@ RoutingProtocol::Forwarding (Ptr<const Packet> p, const Ipv4Header & header,
            *  path to the destination is updated to be no less than the current
            *  time plus ActiveRouteTimeout.
            */
-          UpdateRouteLifeTime (origin, ActiveRouteTimeout);
-          UpdateRouteLifeTime (dst, ActiveRouteTimeout);
+          RoutingTableEntry * toOrigin = m_routingTable.LookupCachedRoute (origin);
+          if (!toOrigin)
+            toOrigin = m_routingTable.LookupRoute (origin);
+          m_routingTable.UpdateLifeTime (toOrigin, ActiveRouteTimeout);
+          m_routingTable.UpdateLifeTime (toDst, ActiveRouteTimeout);
           UpdateRouteLifeTime (route->GetGateway (), ActiveRouteTimeout);
           /*
            *  Since the route between each originator and destination pair is expected to be symmetric, the
            *  Active Route Lifetime for the previous hop, along the reverse path back to the IP source, is also updated
            *  to be no less than the current time plus ActiveRouteTimeout
            */
-          RoutingTableEntry toOrigin;
-          m_routingTable.LookupRoute (origin, toOrigin);
-          UpdateRouteLifeTime (toOrigin.GetNextHop (), ActiveRouteTimeout);
+          Ipv4Address prevHop;
+          if (toOrigin)
+            prevHop = toOrigin->GetNextHop ();
+          UpdateRouteLifeTime (prevHop, ActiveRouteTimeout);
 
-          m_nb.Update (route->GetGateway (), ActiveRouteTimeout);
-          m_nb.Update (toOrigin.GetNextHop (), ActiveRouteTimeout);
+          // Extends the expire time of known neighbors in place, unknown ones or ones without hardware address go through Update ()
+          m_nb.Touch (route->GetGateway (), ActiveRouteTimeout);
+          m_nb.Touch (prevHop, ActiveRouteTimeout);
 
           ucb (route, p, header);
           return true;
         }
       else
         {
-          if (toDst.GetValidSeqNo ())
+          if (toDst->GetValidSeqNo ())
             {
-              SendRerrWhenNoRouteToForward (dst, toDst.GetSeqNo (), origin);
+              SendRerrWhenNoRouteToForward (dst, toDst->GetSeqNo (), origin);
               NS_LOG_DEBUG ("Drop packet " << p->GetUid () << " because no route to forward it.");
               return false;
             }
@@ -725,6 +870,60 @@ RoutingProtocol::NotifyInterfaceUp (uint32_t i)
 
   mac->TraceConnectWithoutContext ("TxErrHeader", m_nb.GetTxErrorCallback ());
   m_nb.AddArpCache (l3->GetInterface (i)->GetArpCache ());
+  // Hellos and RREQs are broadcast, a non promiscuous handler sees them without the unicast frames
+  // of other nodes. It stays registered while the interface is down, where it ignores the frames
+  if (LearnArpFromControl
+      && std::find (m_arpLearningDevices.begin (), m_arpLearningDevices.end (), dev) == m_arpLearningDevices.end ())
+    {
+      GetObject<Node> ()->RegisterProtocolHandler (MakeCallback (&RoutingProtocol::LearnHardwareAddress, this),
+                                                   Ipv4L3Protocol::PROT_NUMBER, dev, false);
+      m_arpLearningDevices.push_back (dev);
+    }
+}
+
+void
+RoutingProtocol::LearnHardwareAddress (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                                       Address const & from, Address const & to, NetDevice::PacketType packetType)
+{
+  if (packetType == NetDevice::PACKET_OTHERHOST || !Mac48Address::IsMatchingType (from))
+    return;
+  // The handler sees every IPv4 frame: read only the leading bytes into a stack buffer, without a
+  // packet copy or header objects (IPv4 header with options, UDP header and the AODV type byte)
+  uint8_t head[60 + 8 + 1];
+  uint32_t size = packet->CopyData (head, sizeof (head));
+  uint32_t ihl = size > 0 ? (head[0] & 0x0f) * 4 : 0;
+  if (ihl < 20 || size < ihl + 9)
+    return;
+  uint8_t const * udp = head + ihl;
+  if (((udp[2] << 8) | udp[3]) != AODV_PORT || head[9] != UdpL4Protocol::PROT_NUMBER)
+    return;
+  // Unfragmented only: no more fragments flag and no fragment offset
+  if ((((head[6] & 0x3f) << 8) | head[7]) != 0 || (udp[8] != TYPE_HELLO && udp[8] != AODVTYPE_RREQ))
+    return;
+  Ipv4Address src = Ipv4Address::Deserialize (head + 12);
+  int32_t interface = m_ipv4->GetInterfaceForDevice (device);
+  if (interface < 0 || !m_ipv4->IsUp (interface) || IsMyOwnAddress (src))
+    return;
+  Ptr<ArpCache> arp = m_ipv4->GetObject<Ipv4L3Protocol> ()->GetInterface (interface)->GetArpCache ();
+  if (arp == 0)
+    return;
+  ArpCache::Entry * entry = arp->Lookup (src);
+  if (entry == 0)
+    {
+      // New entries are ALIVE
+      entry = arp->Add (src);
+      m_arpLearned++;
+    }
+  else if (!entry->IsAlive ())
+    // Waiting entries belong to the ARP exchange in progress, dead ones to ARP retries, and
+    // permanent ones to the user
+    return;
+  else
+    m_arpRefreshed++;
+  NS_LOG_LOGIC ("ARP entry " << src << " -> " << Mac48Address::ConvertFrom (from) << " from type " << uint32_t (udp[8]));
+  // Ages with the ARP alive timeout like a resolved entry, each hello or RREQ of the neighbor restarts it
+  entry->SetMacAddresss (from);
+  entry->UpdateSeen ();
 }
 
 void
@@ -1085,27 +1284,15 @@ bool
 RoutingProtocol::UpdateRouteLifeTime (Ipv4Address addr, Time lifetime)
 {
   NS_LOG_FUNCTION (this << addr << lifetime);
-  RoutingTableEntry rt;
-  if (m_routingTable.LookupRoute (addr, rt))
-    {
-      if (rt.GetFlag () == VALID)
-        {
-          NS_LOG_DEBUG ("Updating VALID route");
-          rt.SetRreqCnt (0);
-          rt.SetLifeTime (std::max (lifetime, rt.GetLifeTime ()));
-          m_routingTable.Update (rt);
-          return true;
-        }
-    }
-  return false;
+  return m_routingTable.UpdateLifeTime (addr, lifetime);
 }
 
 void
 RoutingProtocol::UpdateRouteToNeighbor (Ipv4Address sender, Ipv4Address receiver)
 {
   NS_LOG_FUNCTION (this << "sender " << sender << " receiver " << receiver);
-  RoutingTableEntry toNeighbor;
-  if (!m_routingTable.LookupRoute (sender, toNeighbor))
+  RoutingTableEntry * toNeighbor = m_routingTable.LookupRoute (sender);
+  if (!toNeighbor)
     {
       Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
       RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ sender, /*know seqno=*/ false, /*seqno=*/ 0,
@@ -1116,15 +1303,12 @@ RoutingProtocol::UpdateRouteToNeighbor (Ipv4Address sender, Ipv4Address receiver
   else
     {
       Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
-      if (toNeighbor.GetValidSeqNo () && (toNeighbor.GetHop () == 1) && (toNeighbor.GetOutputDevice () == dev))
-        {
-          toNeighbor.SetLifeTime (std::max (ActiveRouteTimeout, toNeighbor.GetLifeTime ()));
-        }
-      else
+      // A valid one-hop route through the same device is left as it is
+      if (!toNeighbor->GetValidSeqNo () || (toNeighbor->GetHop () != 1) || (toNeighbor->GetOutputDevice () != dev))
         {
           RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ sender, /*know seqno=*/ false, /*seqno=*/ 0,
                                                   /*iface=*/ m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0),
-                                                  /*hops=*/ 1, /*next hop=*/ sender, /*lifetime=*/ std::max (ActiveRouteTimeout, toNeighbor.GetLifeTime ()));
+                                                  /*hops=*/ 1, /*next hop=*/ sender, /*lifetime=*/ std::max (ActiveRouteTimeout, toNeighbor->GetLifeTime ()));
           m_routingTable.Update (newEntry);
         }
     }
@@ -1346,11 +1530,9 @@ RoutingProtocol::SendReplyByIntermediateNode (RoutingTableEntry & toDst, Routing
   if (toDst.GetHop () == 1)
     {
       rrepHeader.SetAckRequired (true);
-      RoutingTableEntry toNextHop;
-      m_routingTable.LookupRoute (toOrigin.GetNextHop (), toNextHop);
-      toNextHop.m_ackTimer.SetFunction (&RoutingProtocol::AckTimerExpire, this);
-      toNextHop.m_ackTimer.SetArguments (toNextHop.GetDestination (), BlackListTimeout);
-      toNextHop.m_ackTimer.SetDelay (NextHopWait);
+      Ipv4Address nextHop = toOrigin.GetNextHop ();
+      m_routingTable.SetAckTimer (nextHop, Simulator::Schedule (NextHopWait, &RoutingProtocol::AckTimerExpire,
+                                                                this, nextHop, BlackListTimeout));
     }
   toDst.InsertPrecursor (toOrigin.GetNextHop ());
   toOrigin.InsertPrecursor (toDst.GetNextHop ());
@@ -1538,7 +1720,7 @@ RoutingProtocol::RecvReplyAck (Ipv4Address neighbor)
   RoutingTableEntry rt;
   if(m_routingTable.LookupRoute (neighbor, rt))
     {
-      rt.m_ackTimer.Cancel ();
+      m_routingTable.CancelAckTimer (neighbor);
       rt.SetFlag (VALID);
       m_routingTable.Update (rt);
     }
@@ -1555,7 +1737,7 @@ void RoutingProtocol::RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Addres
   p->RemoveHeader (helloHeader);
   NS_LOG_FUNCTION (this << "from " << helloHeader.GetOriginatorAddress ());
 
-  uint32_t seqNum = helloHeader.GetMessageSequenceNumber();
+  uint16_t seqNum = helloHeader.GetMessageSequenceNumber();
   Ipv4Address origin = helloHeader.GetOriginatorAddress();
 
 	/*
@@ -1570,8 +1752,8 @@ void RoutingProtocol::RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Addres
 	m_nb.UpdateMulticastNeighborTuple(&helloHeader, GetLongInterval()); 	// Update node's view on the neighbor two hop BN with information provided by the hello message
 	NS_LOG_DEBUG ("Node "<< receiver << " receives HELLO from "<< sender);
 
-  RoutingTableEntry toNeighbor;
-  if (!m_routingTable.LookupRoute(helloHeader.GetOriginatorAddress(),toNeighbor)) 
+  RoutingTableEntry * toNeighbor = m_routingTable.LookupRoute (helloHeader.GetOriginatorAddress ());
+  if (!toNeighbor)
     {
       Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
 		RoutingTableEntry newEntry(/*device=*/dev, /*dst=*/ helloHeader.GetOriginatorAddress(),
@@ -1582,13 +1764,15 @@ void RoutingProtocol::RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Addres
     }
   else
     {
-      toNeighbor.SetLifeTime (std::max (Time ((AllowedHelloLoss + 1) * HelloInterval), toNeighbor.GetLifeTime ()));
-      toNeighbor.SetSeqNo(helloHeader.GetMessageSequenceNumber());
-      toNeighbor.SetValidSeqNo (true);
-      toNeighbor.SetFlag (VALID);
-      toNeighbor.SetOutputDevice (m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver)));
-      toNeighbor.SetInterface (m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0));
-      m_routingTable.Update (toNeighbor);
+      toNeighbor->SetLifeTime (std::max (Time ((AllowedHelloLoss + 1) * HelloInterval), toNeighbor->GetLifeTime ()));
+      toNeighbor->SetSeqNo(helloHeader.GetMessageSequenceNumber());
+      toNeighbor->SetValidSeqNo (true);
+      toNeighbor->SetFlag (VALID);
+      toNeighbor->SetRreqCnt (0);
+      int32_t interface = m_ipv4->GetInterfaceForAddress (receiver);
+      // Usually unchanged, in which case the shared route is left alone
+      m_routingTable.SetOutputDevice (helloHeader.GetOriginatorAddress (), m_ipv4->GetNetDevice (interface),
+                                      m_ipv4->GetAddress (interface, 0));
     }
   if (EnableHello)
     {
@@ -1608,17 +1792,11 @@ RoutingProtocol::RecvError (Ptr<Packet> p, Ipv4Address src )
   std::pair<Ipv4Address, uint32_t> un;
   while (rerrHeader.RemoveUnDestination (un))
     {
-      for (std::map<Ipv4Address, uint32_t>::const_iterator i =
-           dstWithNextHopSrc.begin (); i != dstWithNextHopSrc.end (); ++i)
-      {
-        if (i->first == un.first)
-          {
-            unreachable.insert (un);
-          }
-      }
+      if (dstWithNextHopSrc.find (un.first) != dstWithNextHopSrc.end ())
+        unreachable.insert (un);
     }
 
-  std::vector<Ipv4Address> precursors;
+  PrecursorSet precursors;
   for (std::map<Ipv4Address, uint32_t>::const_iterator i = unreachable.begin ();
        i != unreachable.end ();)
     {
@@ -1633,9 +1811,9 @@ RoutingProtocol::RecvError (Ptr<Packet> p, Ipv4Address src )
         }
       else
         {
-          RoutingTableEntry toDst;
-          m_routingTable.LookupRoute (i->first, toDst);
-          toDst.GetPrecursors (precursors);
+          RoutingTableEntry * toDst = m_routingTable.LookupRoute (i->first);
+          if (toDst)
+            toDst->GetPrecursors (precursors);
           ++i;
         }
     }
@@ -1775,6 +1953,8 @@ void
 RoutingProtocol::AckTimerExpire (Ipv4Address neighbor, Time blacklistTimeout)
 {
   NS_LOG_FUNCTION (this);
+  // The timer has run, release its side table entry
+  m_routingTable.CancelAckTimer (neighbor);
   m_routingTable.MarkLinkAsUnidirectional (neighbor, blacklistTimeout);
 }
 
@@ -1827,23 +2007,72 @@ void
 RoutingProtocol::SendPacketFromQueue (Ipv4Address dst, Ptr<Ipv4Route> route)
 {
   NS_LOG_FUNCTION (this);
-  QueueEntry queueEntry;
-  while (m_queue.Dequeue (dst, queueEntry))
+  std::vector<QueueEntry> entries;
+  uint32_t burst = m_queue.DequeueAll (dst, entries);
+  if (burst == 0)
+    return;
+  // The first packet leaves at once, pacing only spreads the rest of the backlog
+  SendQueuedPacket (entries.front (), route);
+  if (burst > 1 && !QueueDrainInterval.IsZero ())
     {
-      DeferredRouteOutputTag tag;
-      Ptr<Packet> p = ConstCast<Packet> (queueEntry.GetPacket ());
-      if (p->RemovePacketTag (tag) && 
-          tag.oif != -1 && 
-          tag.oif != m_ipv4->GetInterfaceForDevice (route->GetOutputDevice ()))
+      // Forget the events of earlier bursts that already ran
+      std::vector<EventId>::iterator live = m_pacedEvents.begin ();
+      for (std::vector<EventId>::iterator i = m_pacedEvents.begin (); i != m_pacedEvents.end (); ++i)
+        if (!i->IsExpired ())
+          *live++ = *i;
+      m_pacedEvents.erase (live, m_pacedEvents.end ());
+    }
+  for (uint32_t i = 1; i < burst; ++i)
+    {
+      if (QueueDrainInterval.IsZero ())
+        SendQueuedPacket (entries[i], route);
+      else
+        m_pacedEvents.push_back (Simulator::Schedule (QueueDrainInterval * i, &RoutingProtocol::SendPacedPacket, this, entries[i]));
+    }
+  Time drain = QueueDrainInterval * (burst - 1);
+  NS_LOG_LOGIC ("Released " << burst << " packets to " << dst << " over " << drain.GetSeconds () << " s");
+  m_queueDrainTrace (dst, burst, drain);
+}
+
+void
+RoutingProtocol::SendQueuedPacket (QueueEntry queueEntry, Ptr<Ipv4Route> route)
+{
+  DeferredRouteOutputTag tag;
+  Ptr<Packet> p = ConstCast<Packet> (queueEntry.GetPacket ());
+  if (p->RemovePacketTag (tag) && 
+      tag.oif != -1 && 
+      tag.oif != m_ipv4->GetInterfaceForDevice (route->GetOutputDevice ()))
+    {
+      NS_LOG_DEBUG ("Output device doesn't match. Dropped.");
+      return;
+    }
+  UnicastForwardCallback ucb = queueEntry.GetUnicastForwardCallback ();
+  Ipv4Header header = queueEntry.GetIpv4Header ();
+  header.SetSource (route->GetSource ());
+  header.SetTtl (header.GetTtl () + 1); // compensate extra TTL decrement by fake loopback routing
+  ucb (route, p, header);
+}
+
+void
+RoutingProtocol::SendPacedPacket (QueueEntry queueEntry)
+{
+  RoutingTableEntry * rt = m_routingTable.LookupValidRoute (queueEntry.GetIpv4Header ().GetDestination ());
+  if (rt)
+    {
+      SendQueuedPacket (queueEntry, rt->GetRoute ());
+      return;
+    }
+  Ipv4Address dst = queueEntry.GetIpv4Header ().GetDestination ();
+  NS_LOG_LOGIC ("Route to " << dst << " lost while draining, queue packet again");
+  // Like DeferredRouteOutput (), but the packet keeps the queue deadline it got on arrival
+  if (m_queue.Requeue (queueEntry))
+    {
+      rt = m_routingTable.LookupRoute (dst);
+      if (!rt || rt->GetFlag () != IN_SEARCH)
         {
-          NS_LOG_DEBUG ("Output device doesn't match. Dropped.");
-          return;
+          NS_LOG_LOGIC ("Send new RREQ for paced packet to " << dst);
+          SendRequest (dst);
         }
-      UnicastForwardCallback ucb = queueEntry.GetUnicastForwardCallback ();
-      Ipv4Header header = queueEntry.GetIpv4Header ();
-      header.SetSource (route->GetSource ());
-      header.SetTtl (header.GetTtl () + 1); // compensate extra TTL decrement by fake loopback routing
-      ucb (route, p, header);
     }
 }
 
@@ -1851,36 +2080,53 @@ void
 RoutingProtocol::SendRerrWhenBreaksLinkToNextHop (Ipv4Address nextHop)
 {
   NS_LOG_FUNCTION (this << nextHop);
-  RerrHeader rerrHeader;
-  std::vector<Ipv4Address> precursors;
-  std::map<Ipv4Address, uint32_t> unreachable;
+  SendRerrWhenBreaksLinksToNextHops (std::vector<Ipv4Address> (1, nextHop));
+}
 
-  RoutingTableEntry toNextHop;
-  if (!m_routingTable.LookupRoute (nextHop, toNextHop))
+void
+RoutingProtocol::AddRerrDestination (RerrHeader & rerrHeader, Ipv4Address dst, uint32_t seqNo,
+                                     PrecursorSet const & precursors)
+{
+  if (rerrHeader.AddUnDestination (dst, seqNo))
     return;
-  toNextHop.GetPrecursors (precursors);
-  rerrHeader.AddUnDestination (nextHop, toNextHop.GetSeqNo ());
-  m_routingTable.GetListOfDestinationWithNextHop (nextHop, unreachable);
-  for (std::map<Ipv4Address, uint32_t>::const_iterator i = unreachable.begin (); i
-      != unreachable.end ();)
-    {
-      if (!rerrHeader.AddUnDestination (i->first, i->second))
-        {
-          NS_LOG_INFO ("Send RERR message with maximum size.");
-          TypeHeader typeHeader (AODVTYPE_RERR);
-          Ptr<Packet> packet = Create<Packet> ();
-          packet->AddHeader (rerrHeader);
-          packet->AddHeader (typeHeader);
-          SendRerrMessage (packet, precursors);
-          rerrHeader.Clear ();
-        }
-      else
+  NS_LOG_INFO ("Send RERR message with maximum size.");
+  TypeHeader typeHeader (AODVTYPE_RERR);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (rerrHeader);
+  packet->AddHeader (typeHeader);
+  SendRerrMessage (packet, precursors);
+  rerrHeader.Clear ();
+  rerrHeader.AddUnDestination (dst, seqNo);
+}
+
+void
+RoutingProtocol::SendRerrWhenBreaksLinksToNextHops (std::vector<Ipv4Address> const & nextHops)
+{
+  NS_LOG_FUNCTION (this << nextHops.size ());
+  RerrHeader rerrHeader;
+  PrecursorSet precursors;
+  std::map<Ipv4Address, uint32_t> unreachable;
+  // Destinations of all the broken links, invalidated together
+  std::map<Ipv4Address, uint32_t> invalid;
+
+  for (std::vector<Ipv4Address>::const_iterator nextHop = nextHops.begin (); nextHop != nextHops.end (); ++nextHop)
+    {
+      RoutingTableEntry * toNextHop = m_routingTable.LookupRoute (*nextHop);
+      if (!toNextHop)
+        continue;
+      toNextHop->GetPrecursors (precursors);
+      uint32_t nextHopSeqNo = toNextHop->GetSeqNo ();
+      AddRerrDestination (rerrHeader, *nextHop, nextHopSeqNo, precursors);
+      m_routingTable.GetListOfDestinationWithNextHop (*nextHop, unreachable);
+      for (std::map<Ipv4Address, uint32_t>::const_iterator i = unreachable.begin (); i != unreachable.end (); ++i)
         {
-          RoutingTableEntry toDst;
-          m_routingTable.LookupRoute (i->first, toDst);
-          toDst.GetPrecursors (precursors);
-          ++i;
+          AddRerrDestination (rerrHeader, i->first, i->second, precursors);
+          RoutingTableEntry * toDst = m_routingTable.LookupRoute (i->first);
+          if (toDst)
+            toDst->GetPrecursors (precursors);
         }
+      invalid.insert (unreachable.begin (), unreachable.end ());
+      invalid.insert (std::make_pair (*nextHop, nextHopSeqNo));
     }
   if (rerrHeader.GetDestCount () != 0)
     {
@@ -1890,8 +2136,8 @@ RoutingProtocol::SendRerrWhenBreaksLinkToNextHop (Ipv4Address nextHop)
       packet->AddHeader (typeHeader);
       SendRerrMessage (packet, precursors);
     }
-  unreachable.insert (std::make_pair (nextHop, toNextHop.GetSeqNo ()));
-  m_routingTable.InvalidateRoutesWithDst (unreachable);
+  if (!invalid.empty ())
+    m_routingTable.InvalidateRoutesWithDst (invalid);
 }
 
 void
@@ -1953,11 +2199,11 @@ RoutingProtocol::SendRerrWhenNoRouteToForward (Ipv4Address dst,
 }
 
 void
-RoutingProtocol::SendRerrMessage (Ptr<Packet> packet, std::vector<Ipv4Address> precursors)
+RoutingProtocol::SendRerrMessage (Ptr<Packet> packet, PrecursorSet const & precursorSet)
 {
   NS_LOG_FUNCTION (this);
   m_txTrace (packet->Copy ()); // trace
-  if (precursors.empty ())
+  if (precursorSet.IsEmpty ())
     {
       NS_LOG_LOGIC ("No precursors");
       return;
@@ -1973,6 +2219,8 @@ RoutingProtocol::SendRerrMessage (Ptr<Packet> packet, std::vector<Ipv4Address> p
                                                 << "; suppressing RERR");
       return;
     }
+  std::vector<Ipv4Address> precursors;
+  precursorSet.GetAddresses (precursors);
   // If there is only one precursor, RERR SHOULD be unicast toward that precursor
   if (precursors.size () == 1)
     {
@@ -2098,10 +2346,10 @@ bool
 RoutingProtocol::HandleJoin() {
 	NS_LOG_FUNCTION (this);
 	bool convert = false;
-	bool conversion1a = m_nb.GetOneHopNeighbors(NEIGH_NODE).empty();
+	bool conversion1a = m_nb.GetOneHopNeighborView(NEIGH_NODE).empty();
 	NeighborTuple *best_bcn = m_nb.GetBestNeighbor(CORE);// get the best Bcn
 	bool conversion1b = (best_bcn != NULL && HigherWeight(best_bcn));// || best_bcn == NULL;
-	bool conversion2 = !(m_nb.GetClients(CORE).empty() && m_nb.GetClients(RN_NODE).empty());
+	bool conversion2 = !(m_nb.GetClientView(CORE).empty() && m_nb.GetClientView(RN_NODE).empty());
 	convert = ((conversion1a && conversion1b) || conversion2);
 	return convert;
 }
@@ -2109,19 +2357,13 @@ RoutingProtocol::HandleJoin() {
 bool
 RoutingProtocol::Are1HopNeighbors(const Ipv4Address &anode_v, const Ipv4Address &anode_w) {
 	NS_LOG_FUNCTION (this);
-	bool neighbors = ! (m_nb.Intersection(m_nb.GetMulticastNeighbors(anode_v),anode_w).empty() && m_nb.Intersection(m_nb.GetMulticastNeighbors(anode_w),anode_v).empty());
-	return neighbors;
+	return m_nb.Are1HopNeighbors(anode_v, anode_w);
 }
 
 bool
 RoutingProtocol::Are2HopNeighbors(const Ipv4Address &BNnode_v, const Ipv4Address &BNnode_w) {
 	NS_LOG_FUNCTION (this << BNnode_v << BNnode_w);
-	AddressSet vset= m_nb.GetMulticastNeighbors(BNnode_v);
-	m_nb.PrintAddressSet(vset);
-	AddressSet wset= m_nb.GetMulticastNeighbors(BNnode_w);
-	m_nb.PrintAddressSet(wset);
-	bool are2hop = !m_nb.Intersection(vset,wset).empty();
-	return are2hop;
+	return m_nb.Are2HopNeighbors(BNnode_v, BNnode_w);
 }
 
 
@@ -2130,63 +2372,51 @@ RoutingProtocol::HandlePushJoinNonDC(const Ipv4Address &BNnode_v, const Ipv4Addr
 	NS_LOG_FUNCTION (this);
 	NS_ASSERT(m_nb.FindNeighborTuple(BNnode_v)->neighborNodeStatus == NEIGH_NODE);
 	NS_ASSERT(m_nb.FindNeighborTuple(BNnode_w)->neighborNodeStatus == NEIGH_NODE || m_nb.FindNeighborTuple(BNnode_w)->neighborNodeStatus == CORE);
-	Groups pairs = IsDirectlyConnected(m_nb.GetOneHopNeighbors(NEIGH_NODE), m_nb.GetOneHopNeighbors(NEIGH_NODE));
+	// Depends on the BN set and 2-hop lists only, and is symmetric in v and w
+	bool known;
+	if (m_nonDcMemo.Find (m_nb, BNnode_v, BNnode_w, known))
+		return known;
+	// The test below is symmetric in x and y, so each unordered pair is visited once
+	Neighbors::PairView pairs (m_nb.GetOneHopNeighborView(NEIGH_NODE));
 	Ipv4Address ipx, ipy;
 	bool xy_exist = false;
 	
-	for (std::list<NeighborPair>::iterator xy = pairs.begin(); xy != pairs.end() && !xy_exist; xy++) {
+	for (Neighbors::PairView::const_iterator xy = pairs.begin(); xy != pairs.end() && !xy_exist; xy++) {
 		ipx = xy->neighborFirstIfaceAddr;
 		ipy = xy->neighborSecondIfaceAddr;
 		if (!Are1HopNeighbors (ipx, ipy)) continue; 
 		if( ipx == BNnode_v || ipx == BNnode_w || ipy == BNnode_v || ipy == BNnode_w )
 			continue;
-		AddressSet NBNw = m_nb.GetMulticastNeighbors(BNnode_v);
-		AddressSet NBNv = m_nb.GetMulticastNeighbors(BNnode_w);
-		bool vBNx = !m_nb.Intersection(NBNv,ipx).empty(); 
-		bool wBNy = !m_nb.Intersection(NBNw,ipy).empty(); 
-		bool vBNy = !m_nb.Intersection(NBNv,ipy).empty();
-		bool wBNx = !m_nb.Intersection(NBNw,ipx).empty();
+		bool vBNx = m_nb.HasBnNeighbor(BNnode_w, ipx); 
+		bool wBNy = m_nb.HasBnNeighbor(BNnode_v, ipy); 
+		bool vBNy = m_nb.HasBnNeighbor(BNnode_w, ipy);
+		bool wBNx = m_nb.HasBnNeighbor(BNnode_v, ipx);
 		xy_exist |= ((vBNx && wBNy) || (vBNy && wBNx ));
 		
 	}
+	m_nonDcMemo.Insert (m_nb, BNnode_v, BNnode_w, xy_exist);
+	m_nonDcMemo.Insert (m_nb, BNnode_w, BNnode_v, xy_exist);
 	return xy_exist;
 }
 
-Groups
-RoutingProtocol::HandleJoinAmNotDuplex(NeighborSet set_1, NeighborSet set_2){
+bool
+RoutingProtocol::HandleJoinAmNotDuplex(const Ipv4Address &ipv, const Ipv4Address &ipw){
 	NS_LOG_FUNCTION (this);
-	Groups no_connected_pair; 
-	Groups pairs = IsDirectlyConnected(set_1,set_2);
-	for (Groups::iterator pair = pairs.begin(); pair != pairs.end(); pair++) {
-	
-		Ipv4Address ipv,ipw;
-		AddressSet NBNv,NBNw;
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		NS_ASSERT (ipv!=ipw);
-		NS_ASSERT(m_nb.IsNeighbor(ipv) && m_nb.IsNeighbor(ipw));
-		NBNv = m_nb.GetMulticastNeighbors(ipv);
-		NBNw = m_nb.GetMulticastNeighbors(ipw);
-		bool are1hop = !m_nb.Intersection(NBNv, ipw).empty() || !m_nb.Intersection(NBNw, ipv).empty();
-
-		bool are2hop = !m_nb.Intersection(NBNv, NBNw).empty();
-		if ( !(are1hop || are2hop) ) { 
-			bool RULE1 = GetRule1() && HandlePushJoinNonDC(ipv, ipw); 
-			if (!RULE1) {
-				NeighborPair nnpp = {ipv, ipw}; 
-				no_connected_pair.push_back(nnpp);
-				
-			}
-			else
+	NS_ASSERT (ipv!=ipw);
+	NS_ASSERT(m_nb.FindNeighborTuple(ipv) && m_nb.FindNeighborTuple(ipw));
+	bool are1hop = m_nb.Are1HopNeighbors(ipv, ipw);
+
+	bool are2hop = m_nb.Are2HopNeighbors(ipv, ipw);
+	if ( !(are1hop || are2hop) ) { 
+		bool RULE1 = GetRule1() && HandlePushJoinNonDC(ipv, ipw); 
+		if (!RULE1)
+			return true;
 NS_LOG_DEBUG(" is directly Connected through: Node v,w <" << ipv << "," << ipw
-						<<"> are NOT 1 hop ("<<are1hop<<") neither 2-Hop ("<<are2hop<<") neighbors"<<RULE1);
-				
-		}
-		else
-NS_LOG_DEBUG("not directly Connected: Node v,w <" << ipv << "," << ipw <<"> are 1 hop ("<<are1hop<<") or  2-Hop ("<<are2hop<<") neighbors ");
-			
+					<<"> are NOT 1 hop ("<<are1hop<<") neither 2-Hop ("<<are2hop<<") neighbors"<<RULE1);
 	}
-	return no_connected_pair;
+	else
+NS_LOG_DEBUG("not directly Connected: Node v,w <" << ipv << "," << ipw <<"> are 1 hop ("<<are1hop<<") or  2-Hop ("<<are2hop<<") neighbors ");
+	return false;
 }
 
 bool
@@ -2204,20 +2434,6 @@ bool ex (int i) {
   return ((i%2)==1);
 }
 //
-Groups
-RoutingProtocol::IsDirectlyConnected(NeighborSet one, NeighborSet two){
-	NS_LOG_FUNCTION (this);
-	Groups all_pairs;
-	for(NeighborSet::iterator iter1 = one.begin(); iter1 != one.end(); iter1++){
-		for(NeighborSet::iterator iter2 = two.begin(); iter2!= two.end(); iter2++){
-			if(iter1->neighborIfaceAddr==iter2->neighborIfaceAddr)continue;
-			NeighborPair np = {iter1->neighborIfaceAddr,iter2->neighborIfaceAddr};
-				all_pairs.push_back(np);
-		}
-	}
-	return all_pairs;
-}
-
 bool
 RoutingProtocol::HandlePushJoin() {
 	NS_LOG_FUNCTION(this);
@@ -2226,28 +2442,21 @@ RoutingProtocol::HandlePushJoin() {
 	bool neighbor_xw = false;
 	Ipv4Address ipv, ipw, ipx;
 
-	Groups BNPairs = IsDirectlyConnected(m_nb.GetOneHopNeighbors(NEIGH_NODE),m_nb.GetOneHopNeighbors(NEIGH_NODE));
-	NeighborSet BCNnodes = m_nb.GetOneHopNeighbors(CORE);
-	for(Groups::iterator pair = BNPairs.begin(); pair != BNPairs.end() && !pair2connect; pair++){
+	// Every test below is symmetric in v and w, so each unordered pair is visited once
+	Neighbors::PairView BNPairs (m_nb.GetOneHopNeighborView(NEIGH_NODE));
+	Neighbors::View BCNnodes = m_nb.GetOneHopNeighborView(CORE);
+	for(Neighbors::PairView::const_iterator pair = BNPairs.begin(); pair != BNPairs.end() && !pair2connect; pair++){
 		ipv = pair->neighborFirstIfaceAddr;
 		ipw = pair->neighborSecondIfaceAddr;
 		bool onehop = Are1HopNeighbors(ipv,ipw);
 		bool twohop = Are2HopNeighbors(ipv,ipw);
-		{
-			AddressSet BNv = m_nb.GetMulticastNeighbors(ipv);
-			BNv.push_back(ipv);
-			AddressSet BNw = m_nb.GetMulticastNeighbors(ipw);
-			BNw.push_back(ipw);
-			bool onetwo = !(m_nb.Intersection (BNv,BNw).empty());
-			NS_ASSERT (onetwo == (onehop||twohop));
-		}
 		bool ruleone = (GetRule1() && HandlePushJoinNonDC(ipv,ipw));
 		if ( onehop || twohop || ruleone ) {
 			
 			continue;
 		}
 		bool x_exist = false, higher = false;
-		for (NeighborSet::iterator bcn_x = BCNnodes.begin(); bcn_x!= BCNnodes.end() && !x_exist ; bcn_x++) {// for each x in Nbcn(u)
+		for (Neighbors::View::const_iterator bcn_x = BCNnodes.begin(); bcn_x!= BCNnodes.end() && !x_exist ; bcn_x++) {// for each x in Nbcn(u)
 			ipx = bcn_x->neighborIfaceAddr;
 			neighbor_xv = Are1HopNeighbors(ipx, ipv);
 			neighbor_xw = Are1HopNeighbors(ipx, ipw);
@@ -2266,35 +2475,23 @@ bool
 RoutingProtocol::HandleJoinAmDuplex() {
 	NS_LOG_FUNCTION (this);
 
-	Groups no_connected_pair = HandleJoinAmNotDuplex(m_nb.GetOneHopNeighbors(NEIGH_NODE),m_nb.GetOneHopNeighbors(CORE));
-	if (no_connected_pair.empty()) {
-		return false;
-	}
 	bool pair2connect = false;
-	NeighborSet bcn_nodes = m_nb.GetOneHopNeighbors(CORE);
-	Groups::iterator pair_vw;
+	Neighbors::View bcn_nodes = m_nb.GetOneHopNeighborView(CORE);
+	Neighbors::PairView pairs (m_nb.GetOneHopNeighborView(NEIGH_NODE), bcn_nodes);
 	Ipv4Address ipv,ipw,ipx;
-	NeighborSet::iterator bcn_x;
-	for (pair_vw = no_connected_pair.begin() ; pair_vw != no_connected_pair.end() && !pair2connect ; pair_vw++) {
+	for (Neighbors::PairView::const_iterator pair_vw = pairs.begin() ; pair_vw != pairs.end() && !pair2connect ; pair_vw++) {
 		ipv = pair_vw->neighborFirstIfaceAddr;
 		ipw = pair_vw->neighborSecondIfaceAddr;
-		AddressSet NBNw = m_nb.GetMulticastNeighbors(ipw); 
-
-		AddressSet NBNv = m_nb.GetMulticastNeighbors(ipv);
-		NBNv.push_front (pair_vw->neighborFirstIfaceAddr); 
-
-		NS_ASSERT(m_nb.Intersection(NBNw,NBNv).empty()); 
-		if (NBNw.empty()) continue; 
+		if (!HandleJoinAmNotDuplex(ipv, ipw)) continue;
+		NS_ASSERT(!m_nb.HaveCommonBn(ipw, ipv) && !m_nb.HasBnNeighbor(ipw, ipv)); 
+		if (m_nb.FindNeighborTuple(ipw)->neighborBnNeighbors.empty()) continue; 
 		bool x_exist = false;
 
-		for (bcn_x = bcn_nodes.begin(); bcn_x != bcn_nodes.end() && !x_exist; bcn_x++) {
+		for (Neighbors::View::const_iterator bcn_x = bcn_nodes.begin(); bcn_x != bcn_nodes.end() && !x_exist; bcn_x++) {
 			ipx = bcn_x->neighborIfaceAddr;
 			if ( ipx == ipw ) continue; 
-			AddressSet NBNx = m_nb.GetMulticastNeighbors(ipx); 
-
-			bool neighbor_xv = !(m_nb.Intersection(NBNx,ipv).empty());
-			AddressSet intersection = m_nb.Intersection(NBNx, NBNw); 
-			bool neighbor_xz = (!intersection.empty()); 
+			bool neighbor_xv = m_nb.HasBnNeighbor(ipx, ipv);
+			bool neighbor_xz = m_nb.HaveCommonBn(ipx, ipw); 
 			x_exist |= ((neighbor_xv && neighbor_xz) && !HigherWeight(ipx)); 
 			
 		}
@@ -2327,10 +2524,10 @@ RoutingProtocol::HeartBeat_Pushjoin_Anchors() {
 bool
 RoutingProtocol::HeartBeat_Pushjoin_Anchors_1() {
 	NS_LOG_FUNCTION (this);
-	bool cond1 = (m_nb.GetClients(RN_NODE).empty());//no RN clients
+	bool cond1 = (m_nb.GetClientView(RN_NODE).empty());//no RN clients
 	bool cond2 = true;
-	NeighborSet bcn_nodes = m_nb.GetOneHopNeighbors (CORE);
-	for(NeighborSet::iterator bcn_cli = bcn_nodes.begin(); bcn_cli != bcn_nodes.end() && cond1 && cond2; bcn_cli++){
+	Neighbors::View bcn_nodes = m_nb.GetOneHopNeighborView (CORE);
+	for(Neighbors::View::const_iterator bcn_cli = bcn_nodes.begin(); bcn_cli != bcn_nodes.end() && cond1 && cond2; bcn_cli++){
 		if (!bcn_cli->neighborClient) continue;
 		uint32_t bcn_size = bcn_cli->neighborBnNeighbors.size();
 		cond2 &= bcn_size>1; 
@@ -2340,84 +2537,60 @@ RoutingProtocol::HeartBeat_Pushjoin_Anchors_1() {
 }
 
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_2a(Groups gp) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_2a(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	NeighborTuple *nodev,*nodew;
-	Ipv4Address ipv, ipw;
-	Groups no_direct;
-	for(Groups::iterator pair = gp.begin(); pair != gp.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		nodev = m_nb.FindNeighborTuple(ipv);
-		nodew = m_nb.FindNeighborTuple(ipw);
-		bool neighbors = Are1HopNeighbors(ipv,ipw);
-		bool higher = !HigherWeight(ipv) || !HigherWeight(ipw);
-		bool breaker = ((nodev->neighborcore_noncoreIndicator == CONVERT_BREAK) || (nodew->neighborcore_noncoreIndicator == CONVERT_BREAK));
-		if (!(neighbors && (higher||breaker))){ 
-			NeighborPair vw = {ipv,ipw};
-			no_direct.push_back(vw);
-			}
-		
-	}
-
-	return no_direct;
+	Ipv4Address ipv = pair.neighborFirstIfaceAddr;
+	Ipv4Address ipw = pair.neighborSecondIfaceAddr;
+	NeighborTuple *nodev = m_nb.FindNeighborTuple(ipv);
+	NeighborTuple *nodew = m_nb.FindNeighborTuple(ipw);
+	bool neighbors = Are1HopNeighbors(ipv,ipw);
+	bool higher = !HigherWeight(ipv) || !HigherWeight(ipw);
+	bool breaker = ((nodev->neighborcore_noncoreIndicator == CONVERT_BREAK) || (nodew->neighborcore_noncoreIndicator == CONVERT_BREAK));
+	return !(neighbors && (higher||breaker));
 }
 
 
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_2b(Groups gp) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_2b(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	Groups no_indirect;
-	Ipv4Address ipv, ipw, ipx;
-	for(Groups::iterator pair = gp.begin(); pair != gp.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		bool convert = false;
-		AddressSet nodesX = m_nb.GetCommonBN(*pair);
-		
-		for(AddressSet::iterator commonbn = nodesX.begin(); commonbn != nodesX.end() && !convert; commonbn++){
-			ipx = *commonbn;
-			if (IsMyOwnAddress(ipx)) continue;
-			MulticastBnNeighborTuple *common_bn = m_nb.FindMulticastBnNeighborTuple (ipv,ipx);
-			NS_ASSERT (common_bn);
-			bool higher = !HigherWeight(common_bn);
-			bool breaker = common_bn->twoHopBnNeighborIndicator == CONVERT_BREAK;
-			convert |= (higher||breaker);
-			
-		}
-		if(!convert) no_indirect.push_back(*pair);
+	Ipv4Address ipv = pair.neighborFirstIfaceAddr;
+	Ipv4Address ipw = pair.neighborSecondIfaceAddr;
+	Ipv4Address ipx;
+	// Weight and indicator of x come from the hello of v for (v,w) and of w for (w,v), which may
+	// disagree; the unordered pair is left without anchor when either order is
+	bool convert_v = false, convert_w = false;
+	Neighbors::CommonBnView nodesX = m_nb.GetCommonBnView(pair);
+	
+	for(Neighbors::CommonBnView::const_iterator commonbn = nodesX.begin(); commonbn != nodesX.end() && !(convert_v && convert_w); commonbn++){
+		ipx = *commonbn;
+		if (IsMyOwnAddress(ipx)) continue;
+		MulticastBnNeighborTuple *common_bn = m_nb.FindMulticastBnNeighborTuple (ipv,ipx);
+		MulticastBnNeighborTuple *common_bnw = m_nb.FindMulticastBnNeighborTuple (ipw,ipx);
+		NS_ASSERT (common_bn && common_bnw);
+		convert_v |= !HigherWeight(common_bn) || common_bn->twoHopBnNeighborIndicator == CONVERT_BREAK;
+		convert_w |= !HigherWeight(common_bnw) || common_bnw->twoHopBnNeighborIndicator == CONVERT_BREAK;
 	}
-	return no_indirect;
+	return !(convert_v && convert_w);
 }
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_2c(Groups gp) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_2c(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	Groups no3hop;
-	Ipv4Address ipv, ipw;
-	if (!GetRule1()) return gp;
-	for(Groups::iterator pair = gp.begin(); pair != gp.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		
-		bool RULE1 = HandlePushJoinNonDC(ipv,ipw);
-		if (!RULE1)
-			no3hop.push_back(*pair);
-		
-	}
-	return no3hop;
+	if (!GetRule1()) return true;
+	return !HandlePushJoinNonDC(pair.neighborFirstIfaceAddr,pair.neighborSecondIfaceAddr);
 }
 
 bool
 RoutingProtocol::HeartBeat_Pushjoin_Anchors_2() {
 	NS_LOG_FUNCTION (this);
-	Groups gp = IsDirectlyConnected(m_nb.GetOneHopNeighbors(NEIGH_NODE),m_nb.GetOneHopNeighbors(NEIGH_NODE));
-	Groups gpA = HeartBeat_Pushjoin_Anchors_2a(gp);
-	Groups gpB = HeartBeat_Pushjoin_Anchors_2b(gpA);
-	Groups gpC = HeartBeat_Pushjoin_Anchors_2c(gpB);
-	return gpC.empty();
+	// 2a and 2c are symmetric in v and w and 2b tests both orders, so each unordered pair is visited once
+	Neighbors::PairView gp (m_nb.GetOneHopNeighborView(NEIGH_NODE));
+	for(Neighbors::PairView::const_iterator pair = gp.begin(); pair != gp.end(); pair++)
+		if (HeartBeat_Pushjoin_Anchors_2a(*pair) && HeartBeat_Pushjoin_Anchors_2b(*pair) && HeartBeat_Pushjoin_Anchors_2c(*pair))
+			return false;
+	return true;
 }
 
 bool
@@ -2455,82 +2628,53 @@ RoutingProtocol::GetMyAddress(NeighborTuple *node,Ipv4Address &myself){
 	return true;
 }
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_3a(Groups pairs) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_3a(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	Groups no_direct;
-	Ipv4Address ipv, ipw;
-	for(Groups::iterator pair = pairs.begin(); pair != pairs.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		AddressSet BNw = m_nb.GetMulticastNeighbors(ipw);
-		bool connected = Are1HopNeighbors(ipv,ipw);
-		NeighborTuple* bn = m_nb.FindNeighborTuple(ipv);
-		bool higher = !HigherWeight(bn);
-		bool breaker = (bn->neighborcore_noncoreIndicator == CONVERT_BREAK);
-		
-		if (!(connected && (higher||breaker)))
-			no_direct.push_back(*pair);
-	}
-	return no_direct;
+	Ipv4Address ipv = pair.neighborFirstIfaceAddr;
+	Ipv4Address ipw = pair.neighborSecondIfaceAddr;
+	bool connected = Are1HopNeighbors(ipv,ipw);
+	NeighborTuple* bn = m_nb.FindNeighborTuple(ipv);
+	bool higher = !HigherWeight(bn);
+	bool breaker = (bn->neighborcore_noncoreIndicator == CONVERT_BREAK);
+	return !(connected && (higher||breaker));
 }
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_3b(Groups pairs) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_3b(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	Groups no_indirect;
-	Ipv4Address ipv, ipw;
-	for(Groups::iterator pair = pairs.begin(); pair != pairs.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		bool convert = false;
-		
-		AddressSet nodesx = m_nb.GetCommonBN(*pair);
-		for(AddressSet::iterator bn_x = nodesx.begin(); bn_x != nodesx.end() && !convert; bn_x++){
-			if (IsMyOwnAddress(*bn_x)) continue;
-			MulticastBnNeighborTuple *common_bn = m_nb.FindMulticastBnNeighborTuple(ipv,*bn_x);
-			MulticastBnNeighborTuple *common_bnw = m_nb.FindMulticastBnNeighborTuple(ipw,*bn_x);
-			NS_ASSERT(common_bn && common_bnw && common_bn->twoHopBnNeighborIfaceAddr == common_bnw->twoHopBnNeighborIfaceAddr);
-			bool higher = !HigherWeight(common_bn);
-			bool breaker = common_bn->twoHopBnNeighborIndicator == CONVERT_BREAK;
-			convert |= (higher||breaker);
-			
-		}
-		if (!convert){
-			
-			no_indirect.push_back(*pair);
-		}
+	Ipv4Address ipv = pair.neighborFirstIfaceAddr;
+	Ipv4Address ipw = pair.neighborSecondIfaceAddr;
+	bool convert = false;
+	
+	Neighbors::CommonBnView nodesx = m_nb.GetCommonBnView(pair);
+	for(Neighbors::CommonBnView::const_iterator bn_x = nodesx.begin(); bn_x != nodesx.end() && !convert; bn_x++){
+		if (IsMyOwnAddress(*bn_x)) continue;
+		MulticastBnNeighborTuple *common_bn = m_nb.FindMulticastBnNeighborTuple(ipv,*bn_x);
+		MulticastBnNeighborTuple *common_bnw = m_nb.FindMulticastBnNeighborTuple(ipw,*bn_x);
+		NS_ASSERT(common_bn && common_bnw && common_bn->twoHopBnNeighborIfaceAddr == common_bnw->twoHopBnNeighborIfaceAddr);
+		bool higher = !HigherWeight(common_bn);
+		bool breaker = common_bn->twoHopBnNeighborIndicator == CONVERT_BREAK;
+		convert |= (higher||breaker);
 	}
-	return no_indirect;
+	return !convert;
 }
 
-Groups
-RoutingProtocol::HeartBeat_Pushjoin_Anchors_3c(Groups gp) {
+bool
+RoutingProtocol::HeartBeat_Pushjoin_Anchors_3c(NeighborPair pair) {
 	NS_LOG_FUNCTION (this);
-	Groups no3hop;
-	Ipv4Address ipv, ipw;
-	if (!GetRule1()) return gp;
-	for(Groups::iterator pair = gp.begin(); pair != gp.end(); pair++){
-		ipv = pair->neighborFirstIfaceAddr;
-		ipw = pair->neighborSecondIfaceAddr;
-		
-		bool RULE1 = HandlePushJoinNonDC(ipv,ipw);
-		if (!RULE1)
-			no3hop.push_back(*pair);
-		
-	}
-	return no3hop;
+	if (!GetRule1()) return true;
+	return !HandlePushJoinNonDC(pair.neighborFirstIfaceAddr,pair.neighborSecondIfaceAddr);
 }
 
 bool
 RoutingProtocol::HeartBeat_Pushjoin_Anchors_3() {
 	NS_LOG_FUNCTION (this);
-	Groups pairs = IsDirectlyConnected(m_nb.GetOneHopNeighbors(NEIGH_NODE), m_nb.GetOneHopNeighbors(CORE));
-	Groups pairsA = HeartBeat_Pushjoin_Anchors_3a(pairs);
-	Groups pairsB = HeartBeat_Pushjoin_Anchors_3b(pairsA);
-	Groups pairsC = HeartBeat_Pushjoin_Anchors_3c(pairsB);
-
-	return pairsC.empty();
+	Neighbors::PairView pairs (m_nb.GetOneHopNeighborView(NEIGH_NODE), m_nb.GetOneHopNeighborView(CORE));
+	for(Neighbors::PairView::const_iterator pair = pairs.begin(); pair != pairs.end(); pair++)
+		if (HeartBeat_Pushjoin_Anchors_3a(*pair) && HeartBeat_Pushjoin_Anchors_3b(*pair) && HeartBeat_Pushjoin_Anchors_3c(*pair))
+			return false;
+	return true;
 }
 
 }
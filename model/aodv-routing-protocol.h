@@ -7,6 +7,7 @@
 #include "aodv-packet.h"
 #include "aodv-neighbor.h"
 #include "aodv-dpd.h"
+#include "aodv-seq-window.h"
 #include "ns3/node.h"
 #include "ns3/traced-callback.h"
 #include "ns3/random-variable-stream.h"
@@ -58,6 +59,41 @@ public:
   void SetMaxQueueTime (Time t);
   uint32_t GetMaxQueueLen () const { return MaxQueueLen; }
   void SetMaxQueueLen (uint32_t len);
+  uint32_t GetMaxQueueBytes () const { return m_queue.GetMaxQueueBytes (); }
+  void SetMaxQueueBytes (uint32_t bytes) { m_queue.SetMaxQueueBytes (bytes); }
+  uint32_t GetQueueWeightBackground () const { return m_queue.GetClassWeight (RequestQueue::BACKGROUND); }
+  void SetQueueWeightBackground (uint32_t w) { m_queue.SetClassWeight (RequestQueue::BACKGROUND, w); }
+  uint32_t GetQueueWeightBestEffort () const { return m_queue.GetClassWeight (RequestQueue::BEST_EFFORT); }
+  void SetQueueWeightBestEffort (uint32_t w) { m_queue.SetClassWeight (RequestQueue::BEST_EFFORT, w); }
+  uint32_t GetQueueWeightVideo () const { return m_queue.GetClassWeight (RequestQueue::VIDEO); }
+  void SetQueueWeightVideo (uint32_t w) { m_queue.SetClassWeight (RequestQueue::VIDEO, w); }
+  uint32_t GetQueueWeightVoice () const { return m_queue.GetClassWeight (RequestQueue::VOICE); }
+  void SetQueueWeightVoice (uint32_t w) { m_queue.SetClassWeight (RequestQueue::VOICE, w); }
+  /// Number of packets of traffic class cls dropped from the request queue
+  uint32_t GetQueueDrops (uint32_t cls) const { return m_queue.GetClassDrops (cls); }
+  /// Routing table lookups served by the route cache
+  uint64_t GetRouteCacheHits () const { return m_routingTable.GetCacheHits (); }
+  /// Routing table lookups that missed the route cache
+  uint64_t GetRouteCacheMisses () const { return m_routingTable.GetCacheMisses (); }
+  /// MAC transmit errors towards a known neighbor
+  uint64_t GetTxErrors () const { return m_nb.GetTxErrors (); }
+  /// MAC transmit errors handled by a link failure pass already pending
+  uint64_t GetTxErrorsCoalesced () const { return m_nb.GetTxErrorsCoalesced (); }
+  /// Link failure passes run for MAC transmit errors
+  uint64_t GetTxErrorBatches () const { return m_nb.GetTxErrorBatches (); }
+  /// ARP entries created from received hello and RREQ frames, see LearnArpFromControl
+  uint64_t GetArpEntriesLearned () const { return m_arpLearned; }
+  /// Existing ALIVE ARP entries refreshed from received hello and RREQ frames
+  uint64_t GetArpEntriesRefreshed () const { return m_arpRefreshed; }
+  /**
+   * Write binary snapshot of routing table and neighbors with a single write, see aodv-snapshot.h.
+   * The stream should be opened with std::ios::binary.
+   */
+  void WriteSnapshot (Ptr<OutputStreamWrapper> stream);
+  /// Write a snapshot to stream every SnapshotInterval, a null stream stops the snapshots
+  void SetSnapshotStream (Ptr<OutputStreamWrapper> stream);
+  void SetSnapshotInterval (Time t);
+  Time GetSnapshotInterval () const { return SnapshotInterval; }
   bool GetDesinationOnlyFlag () const { return DestinationOnly; }
   void SetDesinationOnlyFlag (bool f) { DestinationOnly = f; }
   bool GetGratuitousReplyFlag () const { return GratuitousReply; }
@@ -66,6 +102,16 @@ public:
   bool GetHelloEnable () const { return EnableHello; }
   void SetBroadcastEnable (bool f) { EnableBroadcast = f; }
   bool GetBroadcastEnable () const { return EnableBroadcast; }
+  void SetDuplicateDetectionMode (DuplicatePacketDetection::Mode mode) { m_dpd.SetMode (mode); }
+  DuplicatePacketDetection::Mode GetDuplicateDetectionMode () const { return m_dpd.GetMode (); }
+  void SetDuplicateDetectionMemory (uint32_t bytes);
+  uint32_t GetDuplicateDetectionMemory () const { return DpdMemory; }
+  void SetDuplicateDetectionFalsePositiveRate (double rate);
+  double GetDuplicateDetectionFalsePositiveRate () const { return DpdFalsePositiveRate; }
+  /// Fraction of bits set in the current duplicate detection filter (BLOOM mode)
+  double GetDuplicateDetectionFill () const { return m_dpd.GetFilter ().GetFill (); }
+  /// False positive rate of duplicate detection estimated from filter fill (BLOOM mode)
+  double GetDuplicateDetectionEstimatedFalsePositiveRate () const { return m_dpd.GetFilter ().GetEstimatedFalsePositiveRate (); }
  void SetMaliciousEnable (bool f) { IsMalicious = f; }                        
 bool GetMaliciousEnable () const { return IsMalicious; }                     
    int64_t AssignStreams (int64_t stream);
@@ -98,9 +144,9 @@ bool GetMaliciousEnable () const { return IsMalicious; }
 
 	
   void GetLocalState ();
-  Groups IsDirectlyConnected(NeighborSet one, NeighborSet two);
-  uint32_t GetOneHopNeighborsSize (aodvmesh::NodeStatus nodeStatus){return m_nb.GetOneHopNeighbors(nodeStatus).size();}
-  Groups HandleJoinAmNotDuplex(NeighborSet one, NeighborSet two);
+  uint32_t GetOneHopNeighborsSize (aodvmesh::NodeStatus nodeStatus){return m_nb.GetNeighborhoodSize(nodeStatus);}
+  /// \return true if v and w are neither 1-hop, 2-hop nor (rule 1) 3-hop BN neighbors
+  bool HandleJoinAmNotDuplex(const Ipv4Address &ipv, const Ipv4Address &ipw);
   bool HigherWeight(Ipv4Address neighbor);
   bool HigherWeight(NeighborTuple *node);
   bool HigherWeight(MulticastBnNeighborTuple *node2hop);
@@ -118,14 +164,15 @@ bool GetMaliciousEnable () const { return IsMalicious; }
   bool HeartBeat_Pushjoin_Anchors();
   bool HeartBeat_Pushjoin_Anchors_1();
   bool HeartBeat_Pushjoin_Anchors_2();
-  Groups HeartBeat_Pushjoin_Anchors_2a(Groups gp);
-  Groups HeartBeat_Pushjoin_Anchors_2b(Groups gp);
-  Groups HeartBeat_Pushjoin_Anchors_2c(Groups gp);
+  /// The 2x and 3x tests return true when pair is left without anchor by that rule
+  bool HeartBeat_Pushjoin_Anchors_2a(NeighborPair pair);
+  bool HeartBeat_Pushjoin_Anchors_2b(NeighborPair pair);
+  bool HeartBeat_Pushjoin_Anchors_2c(NeighborPair pair);
   Groups HeartBeat_Pushjoin_Anchors_2d(Groups gp);
   bool HeartBeat_Pushjoin_Anchors_3();
-  Groups HeartBeat_Pushjoin_Anchors_3a(Groups pairs);
-  Groups HeartBeat_Pushjoin_Anchors_3b(Groups pairs);
-  Groups HeartBeat_Pushjoin_Anchors_3c(Groups pairs);
+  bool HeartBeat_Pushjoin_Anchors_3a(NeighborPair pair);
+  bool HeartBeat_Pushjoin_Anchors_3b(NeighborPair pair);
+  bool HeartBeat_Pushjoin_Anchors_3c(NeighborPair pair);
   //\}
 private:
   ///\name Protocol parameters.
@@ -167,6 +214,11 @@ private:
   bool GratuitousReply;              ///< Indicates whether a gratuitous RREP should be unicast to the node originated route discovery.
   bool EnableHello;                  ///< Indicates whether a hello messages enable
   bool EnableBroadcast;              ///< Indicates whether a a broadcast data packets forwarding enable
+  uint32_t DpdMemory;                ///< Memory budget (bytes) of broadcast duplicate detection in BLOOM mode.
+  double DpdFalsePositiveRate;       ///< Target false positive rate of broadcast duplicate detection in BLOOM mode.
+  Time QueueDrainInterval;           ///< Gap between packets released from the request queue once a route is found, zero sends them all at once.
+  bool LearnArpFromControl;          ///< Indicates whether received hello and RREQ frames install or refresh ARP entries of their sender.
+  Time SnapshotInterval;             ///< Interval between snapshots written to the stream given to SetSnapshotStream (), zero disables them.
   //\}
 
   /// IP protocol
@@ -180,16 +232,30 @@ private:
   RoutingTable m_routingTable;
   /// A "drop-front" queue used by the routing layer to buffer packets to which it does not have a route.
   RequestQueue m_queue;
+  /// Pending SendPacedPacket () events, cancelled on dispose
+  std::vector<EventId> m_pacedEvents;
   /// Broadcast ID
   uint32_t m_requestId;
   /// Request sequence number
   uint32_t m_seqNo;
+  /// ARP entries created by LearnHardwareAddress ()
+  uint64_t m_arpLearned;
+  /// ARP entries updated by LearnHardwareAddress ()
+  uint64_t m_arpRefreshed;
+  /// Devices LearnHardwareAddress () is registered on, at most once each
+  std::vector<Ptr<NetDevice> > m_arpLearningDevices;
   /// Handle duplicated RREQ
   IdCache m_rreqIdCache;
   /// Handle duplicated broadcast/multicast packets
   DuplicatePacketDetection m_dpd;
   /// Handle neighbors
   Neighbors m_nb;
+  /// HandlePushJoinNonDC () results of the current neighbor table epoch
+  PairMemo m_nonDcMemo;
+  /// Snapshot record buffer, reused between snapshots
+  SnapshotWriter m_snapshot;
+  /// Stream of periodic snapshots, see SetSnapshotStream ()
+  Ptr<OutputStreamWrapper> m_snapshotStream;
   /// Number of RREQs used for RREQ rate control
   uint16_t m_rreqCount;
   /// Number of RERRs used for RERR rate control
@@ -201,13 +267,19 @@ bool IsMalicious;
   TracedCallback <Ptr<const Packet> > m_txPacketTrace;
   /// Tracing control traffic received
   TracedCallback <Ptr<const Packet> > m_rxPacketTrace;
+  /// Tracing request queue drains: destination, burst size, drain duration
+  TracedCallback<Ipv4Address, uint32_t, Time> m_queueDrainTrace;
+  /// Tracing request queue drops: packet, traffic class
+  TracedCallback<Ptr<const Packet>, uint32_t> m_queueDropTrace;
+  /// Forward request queue drops to m_queueDropTrace
+  void NotifyQueueDrop (Ptr<const Packet> packet, uint32_t cls) { m_queueDropTrace (packet, cls); }
 
   /// Node main address
   Ipv4Address m_mainAddress;
 
 	///\name AODVMESH protocol parameters
 	//\{
-	IdCache m_helloIdCache;
+	SequenceWindowCache m_helloIdCache; ///< Per originator window of already received hello sequence numbers.
 	uint16_t m_messageSequenceNumber; ///< Message Sequence Number: incremented by one each time a new AODVMESH packet is transmitted.
 	uint16_t m_weightSize; ///< Size of the weight field, counted in bytes and measured from the beginning of the "Weight field" field and until the end of such a field.
 	uint32_t m_localWeight; ///< Local weight.
@@ -268,6 +340,14 @@ private:
   //\{
   /// Receive and process control packet
   void RecvAodv (Ptr<Socket> socket);
+  /**
+   * IPv4 handler installed when LearnArpFromControl is set. For a hello or RREQ frame,
+   * install or refresh an ALIVE ARP entry mapping its IP source to the frame source address, so that
+   * the first unicast to a new neighbor does not wait for an ARP exchange. Other frames are rejected
+   * on their first bytes, without copying the packet.
+   */
+  void LearnHardwareAddress (Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                             Address const & from, Address const & to, NetDevice::PacketType packetType);
   /// Receive HELLO
   void RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src);
   /// Receive RREQ
@@ -286,8 +366,12 @@ private:
 
   ///\name Send
   //\{
-  /// Forward packet from route request queue
+  /// Forward packets from route request queue, paced by QueueDrainInterval
   void SendPacketFromQueue (Ipv4Address dst, Ptr<Ipv4Route> route);
+  /// Forward one packet released from route request queue
+  void SendQueuedPacket (QueueEntry queueEntry, Ptr<Ipv4Route> route);
+  /// Forward paced packet over the route valid at send time, queue it again and look for a route if there is none
+  void SendPacedPacket (QueueEntry queueEntry);
   /// Send hello
   void SendHello ();
   /// Send RREQ
@@ -304,8 +388,12 @@ private:
   void SendReplyAck (Ipv4Address neighbor);
   /// Initiate RERR
   void SendRerrWhenBreaksLinkToNextHop (Ipv4Address nextHop);
+  /// Initiate RERR for several broken links at once, one invalidation pass and as few RERR as fit
+  void SendRerrWhenBreaksLinksToNextHops (std::vector<Ipv4Address> const & nextHops);
+  /// Add destination to rerrHeader, sending it first to precursors if full
+  void AddRerrDestination (RerrHeader & rerrHeader, Ipv4Address dst, uint32_t seqNo, PrecursorSet const & precursors);
   /// Forward RERR
-  void SendRerrMessage (Ptr<Packet> packet,  std::vector<Ipv4Address> precursors);
+  void SendRerrMessage (Ptr<Packet> packet, PrecursorSet const & precursors);
   /**
    * Send RERR message when no route to forward input packet. Unicast if there is reverse route to originating node, broadcast otherwise.
    * \param dst - destination node IP address
@@ -336,6 +424,12 @@ private:
   Timer m_rerrRateLimitTimer;
   /// Reset RERR count and schedule RERR rate limit timer with delay 1 sec.
   void RerrRateLimitTimerExpire ();
+  /// Periodic snapshot timer
+  Timer m_snapshotTimer;
+  /// Write a snapshot and schedule the next one
+  void SnapshotTimerExpire ();
+  /// (Re)start m_snapshotTimer if there is a stream and an interval, stop it otherwise
+  void ScheduleSnapshots ();
   /// Map IP address + RREQ timer.
   std::map<Ipv4Address, Timer> m_addressReqTimer;
   /// Handle route discovery process
@@ -1,9 +1,9 @@
 #include "aodv-rqueue.h"
 #include <algorithm>
-#include <functional>
 #include "ns3/ipv4-route.h"
 #include "ns3/socket.h"
 #include "ns3/log.h"
+#include "ns3/test.h"
 
 NS_LOG_COMPONENT_DEFINE ("AodvRequestQueue");
 
@@ -11,114 +11,497 @@ namespace ns3
 {
 namespace aodvmesh
 {
+RequestQueue::RequestQueue (uint32_t maxLen, Time routeToQueueTimeout) :
+  m_size (0), m_bytes (0), m_maxLen (maxLen), m_maxBytes (0), m_queueTimeout (routeToQueueTimeout)
+{
+}
+
+RequestQueue::~RequestQueue ()
+{
+  m_expireEvent.Cancel ();
+}
+
 uint32_t
 RequestQueue::GetSize ()
 {
-  Purge ();
-  return m_queue.size ();
+  return m_size;
+}
+
+uint32_t
+RequestQueue::GetTrafficClass (uint8_t tos)
+{
+  switch (tos >> 5)
+    {
+    case 1:
+    case 2:
+      return BACKGROUND;
+    case 4:
+    case 5:
+      return VIDEO;
+    case 6:
+    case 7:
+      return VOICE;
+    default:
+      return BEST_EFFORT;
+    }
+}
+
+uint32_t
+RequestQueue::Insert (QueueEntry const & entry)
+{
+  uint32_t n;
+  if (m_free.empty ())
+    {
+      n = m_nodes.size ();
+      m_nodes.push_back (Node ());
+      m_nodes[n].m_stamp = 0;
+    }
+  else
+    {
+      n = m_free.back ();
+      m_free.pop_back ();
+    }
+  Node & node = m_nodes[n];
+  node.m_entry = entry;
+  node.m_class = GetTrafficClass (entry.GetIpv4Header ().GetTos ());
+  Class & c = m_classes[node.m_class];
+  node.m_prevAge = c.m_newest;
+  node.m_nextAge = NIL;
+  if (c.m_newest != NIL)
+    m_nodes[c.m_newest].m_nextAge = n;
+  else
+    c.m_oldest = n;
+  c.m_newest = n;
+  c.m_size++;
+  c.m_bytes += entry.GetPacket ()->GetSize ();
+  m_bytes += entry.GetPacket ()->GetSize ();
+
+  DstList * list = m_dstLists.Insert (entry.GetIpv4Header ().GetDestination ().Get (), DstList ());
+  node.m_prevDst = list->m_tail;
+  node.m_nextDst = NIL;
+  if (list->m_tail != NIL)
+    m_nodes[list->m_tail].m_nextDst = n;
+  else
+    list->m_head = n;
+  list->m_tail = n;
+
+  m_uids.Insert (MakeUidKey (entry), true);
+  m_size++;
+
+  Deadline d;
+  d.m_time = Simulator::Now () + entry.GetExpireTime ();
+  d.m_node = n;
+  d.m_stamp = node.m_stamp;
+  m_deadlines.push_back (d);
+  std::push_heap (m_deadlines.begin (), m_deadlines.end ());
+  if (!m_expireEvent.IsRunning () || d.m_time < m_expireTime)
+    ScheduleExpire ();
+  return n;
+}
+
+QueueEntry
+RequestQueue::Remove (uint32_t n)
+{
+  Node & node = m_nodes[n];
+  Class & c = m_classes[node.m_class];
+  if (node.m_prevAge != NIL)
+    m_nodes[node.m_prevAge].m_nextAge = node.m_nextAge;
+  else
+    c.m_oldest = node.m_nextAge;
+  if (node.m_nextAge != NIL)
+    m_nodes[node.m_nextAge].m_prevAge = node.m_prevAge;
+  else
+    c.m_newest = node.m_prevAge;
+  c.m_size--;
+  c.m_bytes -= node.m_entry.GetPacket ()->GetSize ();
+  m_bytes -= node.m_entry.GetPacket ()->GetSize ();
+
+  uint32_t dst = node.m_entry.GetIpv4Header ().GetDestination ().Get ();
+  if (node.m_prevDst == NIL && node.m_nextDst == NIL)
+    m_dstLists.Erase (dst);
+  else
+    {
+      DstList * list = m_dstLists.Find (dst);
+      if (node.m_prevDst != NIL)
+        m_nodes[node.m_prevDst].m_nextDst = node.m_nextDst;
+      else
+        list->m_head = node.m_nextDst;
+      if (node.m_nextDst != NIL)
+        m_nodes[node.m_nextDst].m_prevDst = node.m_prevDst;
+      else
+        list->m_tail = node.m_prevDst;
+    }
+
+  m_uids.Erase (MakeUidKey (node.m_entry));
+  node.m_stamp++;
+  m_size--;
+  // Release the packet and callbacks held by the pooled node
+  QueueEntry entry = node.m_entry;
+  node.m_entry = QueueEntry ();
+  m_free.push_back (n);
+  return entry;
 }
 
 bool
 RequestQueue::Enqueue (QueueEntry & entry)
 {
-  Purge ();
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  if (m_uids.Find (MakeUidKey (entry)))
+    return false;
+  entry.SetExpireTime (m_queueTimeout);
+  return Admit (entry);
+}
+
+bool
+RequestQueue::Requeue (QueueEntry & entry)
+{
+  if (m_uids.Find (MakeUidKey (entry)))
+    return false;
+  if (entry.GetExpireTime () <= Seconds (0))
     {
-      if ((i->GetPacket ()->GetUid () == entry.GetPacket ()->GetUid ())
-          && (i->GetIpv4Header ().GetDestination ()
-              == entry.GetIpv4Header ().GetDestination ()))
-        return false;
+      Drop (entry, "Drop outdated packet ");
+      return false;
     }
-  entry.SetExpireTime (m_queueTimeout);
-  if (m_queue.size () == m_maxLen)
+  return Admit (entry);
+}
+
+bool
+RequestQueue::Admit (QueueEntry & entry)
+{
+  uint32_t cls = GetTrafficClass (entry.GetIpv4Header ().GetTos ());
+  uint32_t bytes = entry.GetPacket ()->GetSize ();
+  if (m_maxLen == 0 || (m_maxBytes > 0 && bytes > m_maxBytes))
     {
-      Drop (m_queue.front (), "Drop the most aged packet"); // Drop the most aged packet
-      m_queue.erase (m_queue.begin ());
+      Drop (entry, "Packet larger than the queue ");
+      return false;
     }
-  m_queue.push_back (entry);
+  while (IsFull (bytes))
+    {
+      uint32_t victim = SelectVictim (cls, bytes);
+      if (m_classes[victim].m_oldest == NIL)
+        {
+          // Only the new packet is over its class share
+          Drop (entry, "Drop the new packet of the most demanding class ");
+          return false;
+        }
+      Drop (Remove (m_classes[victim].m_oldest), "Drop the most aged packet of the most demanding class ");
+    }
+  Insert (entry);
+  if (m_deadlines.size () > 2 * m_size + 64)
+    CompactDeadlines ();
   return true;
 }
 
+bool
+RequestQueue::IsFull (uint32_t bytes) const
+{
+  return m_size >= m_maxLen || (m_maxBytes > 0 && m_bytes + bytes > m_maxBytes);
+}
+
+uint32_t
+RequestQueue::SelectVictim (uint32_t cls, uint32_t bytes) const
+{
+  // Shares are measured in bytes when the byte budget is what overflows, in packets otherwise
+  bool byBytes = m_maxBytes > 0 && m_bytes + bytes > m_maxBytes;
+  uint32_t victim = CLASSES;
+  uint64_t victimUse = 0;
+  uint64_t victimWeight = 1;
+  for (uint32_t i = 0; i < CLASSES; ++i)
+    {
+      Class const & c = m_classes[i];
+      uint64_t use = byBytes ? c.m_bytes : c.m_size;
+      if (i == cls)
+        use += byBytes ? bytes : 1;
+      else if (c.m_size == 0)
+        continue;
+      uint64_t weight = std::max<uint32_t> (c.m_weight, 1);
+      // use / weight > victimUse / victimWeight
+      if (victim == CLASSES || use * victimWeight > victimUse * weight)
+        {
+          victim = i;
+          victimUse = use;
+          victimWeight = weight;
+        }
+    }
+  return victim;
+}
+
 void
 RequestQueue::DropPacketWithDst (Ipv4Address dst)
 {
   NS_LOG_FUNCTION (this << dst);
-  Purge ();
-  //const Ipv4Address addr = dst;
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  DstList * list;
+  while ((list = m_dstLists.Find (dst.Get ())) != 0)
     {
-      if (IsEqual (*i, dst))
-        {
-          Drop (*i, "DropPacketWithDst ");
-        }
+      Drop (Remove (list->m_head), "DropPacketWithDst ");
     }
-  m_queue.erase (std::remove_if (m_queue.begin (), m_queue.end (),
-                                 std::bind2nd (std::ptr_fun (RequestQueue::IsEqual), dst)), m_queue.end ());
 }
 
 bool
 RequestQueue::Dequeue (Ipv4Address dst, QueueEntry & entry)
 {
-  Purge ();
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+  DstList * list = m_dstLists.Find (dst.Get ());
+  if (list == 0)
+    return false;
+  entry = Remove (list->m_head);
+  return true;
+}
+
+uint32_t
+RequestQueue::DequeueAll (Ipv4Address dst, std::vector<QueueEntry> & entries)
+{
+  DstList * list = m_dstLists.Find (dst.Get ());
+  if (list == 0)
+    return 0;
+  uint32_t n = list->m_head;
+  uint32_t count = 0;
+  // Removing the last entry erases the list, so walk the links instead of re-reading the head
+  while (n != NIL)
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
-        {
-          entry = *i;
-          m_queue.erase (i);
-          return true;
-        }
+      uint32_t next = m_nodes[n].m_nextDst;
+      entries.push_back (Remove (n));
+      n = next;
+      count++;
     }
-  return false;
+  return count;
 }
 
 bool
 RequestQueue::Find (Ipv4Address dst)
 {
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  return m_dstLists.Find (dst.Get ()) != 0;
+}
+
+void
+RequestQueue::Expire ()
+{
+  while (!m_deadlines.empty () && m_deadlines.front ().m_time <= Simulator::Now ())
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
-        return true;
+      Deadline d = m_deadlines.front ();
+      std::pop_heap (m_deadlines.begin (), m_deadlines.end ());
+      m_deadlines.pop_back ();
+      if (m_nodes[d.m_node].m_stamp == d.m_stamp)
+        Drop (Remove (d.m_node), "Drop outdated packet ");
     }
-  return false;
+  ScheduleExpire ();
 }
 
-struct IsExpired
+void
+RequestQueue::ScheduleExpire ()
 {
-  bool
-  operator() (QueueEntry const & e) const
-  {
-    return (e.GetExpireTime () < Seconds (0));
-  }
-};
+  while (!m_deadlines.empty () && m_nodes[m_deadlines.front ().m_node].m_stamp != m_deadlines.front ().m_stamp)
+    {
+      std::pop_heap (m_deadlines.begin (), m_deadlines.end ());
+      m_deadlines.pop_back ();
+    }
+  m_expireEvent.Cancel ();
+  if (m_deadlines.empty ())
+    return;
+  m_expireTime = m_deadlines.front ().m_time;
+  m_expireEvent = Simulator::Schedule (m_expireTime - Simulator::Now (), &RequestQueue::Expire, this);
+}
 
 void
-RequestQueue::Purge ()
+RequestQueue::CompactDeadlines ()
 {
-  IsExpired pred;
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  std::vector<Deadline> live;
+  live.reserve (m_size);
+  for (std::vector<Deadline>::const_iterator i = m_deadlines.begin (); i != m_deadlines.end (); ++i)
     {
-      if (pred (*i))
-        {
-          Drop (*i, "Drop outdated packet ");
-        }
+      if (m_nodes[i->m_node].m_stamp == i->m_stamp)
+        live.push_back (*i);
     }
-  m_queue.erase (std::remove_if (m_queue.begin (), m_queue.end (), pred),
-                 m_queue.end ());
+  std::make_heap (live.begin (), live.end ());
+  m_deadlines.swap (live);
 }
 
 void
 RequestQueue::Drop (QueueEntry en, std::string reason)
 {
   NS_LOG_LOGIC (reason << en.GetPacket ()->GetUid () << " " << en.GetIpv4Header ().GetDestination ());
+  uint32_t cls = GetTrafficClass (en.GetIpv4Header ().GetTos ());
+  m_classes[cls].m_drops++;
+  if (!m_dropCallback.IsNull ())
+    m_dropCallback (en.GetPacket (), cls);
   en.GetErrorCallback () (en.GetPacket (), en.GetIpv4Header (),
                           Socket::ERROR_NOROUTETOHOST);
   return;
 }
 
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for request queue
+struct RequestQueueTest : public TestCase
+{
+  RequestQueueTest () : TestCase ("Request queue"), q (3, Seconds (10))
+  {}
+  virtual void DoRun ();
+  void Error (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno);
+  void Add (Ipv4Address dst);
+  void CheckTimeout1 ();
+  void Take ();
+  void Requeue ();
+  void CheckTimeout2 ();
+
+  RequestQueue q;
+  /// Drop times of packets
+  std::vector<Time> drops;
+  /// Entry taken out of the queue and pushed back
+  QueueEntry taken;
+};
+
+void
+RequestQueueTest::Error (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno)
+{
+  drops.push_back (Simulator::Now ());
+}
+
+void
+RequestQueueTest::Add (Ipv4Address dst)
+{
+  Ipv4Header h;
+  h.SetDestination (dst);
+  QueueEntry e (Create<Packet> (), h, QueueEntry::UnicastForwardCallback (),
+                MakeCallback (&RequestQueueTest::Error, this));
+  q.Enqueue (e);
+}
+
+void
+RequestQueueTest::DoRun ()
+{
+  Ipv4Header h;
+  h.SetDestination (Ipv4Address ("1.2.3.4"));
+  QueueEntry e1 (Create<Packet> (), h, QueueEntry::UnicastForwardCallback (),
+                 MakeCallback (&RequestQueueTest::Error, this));
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (e1), true, "New packet");
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (e1), false, "Same packet and destination");
+  Add (Ipv4Address ("4.3.2.1"));
+  Add (Ipv4Address ("1.2.3.4"));
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 3, "trivial");
+  Add (Ipv4Address ("5.5.5.5"));
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 3, "Queue full");
+  NS_TEST_EXPECT_MSG_EQ (drops.size (), 1, "Most aged packet dropped");
+  QueueEntry e2;
+  NS_TEST_EXPECT_MSG_EQ (q.Dequeue (Ipv4Address ("1.2.3.4"), e2), true, "Remaining packet");
+  NS_TEST_EXPECT_MSG_EQ (q.Find (Ipv4Address ("1.2.3.4")), false, "Evicted packet gone");
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (e1), true, "Evicted packet can come back");
+  Add (Ipv4Address ("1.2.3.4"));
+  std::vector<QueueEntry> all;
+  NS_TEST_EXPECT_MSG_EQ (q.DequeueAll (Ipv4Address ("1.2.3.4"), all), 2, "All packets of destination");
+  NS_TEST_EXPECT_MSG_EQ (all.front ().GetPacket (), e1.GetPacket (), "Arrival order");
+  NS_TEST_EXPECT_MSG_EQ (q.Find (Ipv4Address ("1.2.3.4")), false, "Destination drained");
+  NS_TEST_EXPECT_MSG_EQ (q.Enqueue (e1), true, "Drained packet can come back");
+
+  Simulator::Schedule (Seconds (4), &RequestQueueTest::Add, this, Ipv4Address ("6.6.6.6"));
+  Simulator::Schedule (Seconds (11), &RequestQueueTest::CheckTimeout1, this);
+  Simulator::Schedule (Seconds (12), &RequestQueueTest::Take, this);
+  Simulator::Schedule (Seconds (13), &RequestQueueTest::Requeue, this);
+  Simulator::Schedule (Seconds (15), &RequestQueueTest::CheckTimeout2, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+RequestQueueTest::CheckTimeout1 ()
+{
+  NS_TEST_EXPECT_MSG_EQ (drops.size (), 4, "Packets dropped on their deadline");
+  NS_TEST_EXPECT_MSG_EQ (drops.back (), Seconds (10), "Exact drop time");
+  NS_TEST_EXPECT_MSG_EQ (q.GetSize (), 1, "Younger packet kept");
+  NS_TEST_EXPECT_MSG_EQ (q.Find (Ipv4Address ("6.6.6.6")), true, "Younger packet kept");
+}
+
+void
+RequestQueueTest::Take ()
+{
+  NS_TEST_EXPECT_MSG_EQ (q.Dequeue (Ipv4Address ("6.6.6.6"), taken), true, "Younger packet taken");
+}
+
+void
+RequestQueueTest::Requeue ()
+{
+  NS_TEST_EXPECT_MSG_EQ (q.Requeue (taken), true, "Taken packet pushed back");
+  NS_TEST_EXPECT_MSG_EQ (taken.GetExpireTime (), Seconds (1), "Original deadline kept");
+}
+
+void
+RequestQueueTest::CheckTimeout2 ()
+{
+  NS_TEST_EXPECT_MSG_EQ (drops.size (), 5, "Pushed back packet dropped on its original deadline");
+  NS_TEST_EXPECT_MSG_EQ (drops.back (), Seconds (14), "Exact drop time");
+  NS_TEST_EXPECT_MSG_EQ (q.Requeue (taken), false, "Outdated packet refused");
+  NS_TEST_EXPECT_MSG_EQ (drops.size (), 6, "Outdated packet reported");
+}
+//-----------------------------------------------------------------------------
+
+/// Unit test for byte budget and class-aware eviction of request queue
+struct RequestQueueClassTest : public TestCase
+{
+  RequestQueueClassTest () : TestCase ("Request queue classes"), q (100, Seconds (10)), errors (0)
+  {}
+  virtual void DoRun ();
+  void Error (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno);
+  bool Add (uint32_t size, uint8_t tos);
+
+  RequestQueue q;
+  /// Packets reported to their error callback
+  uint32_t errors;
+};
+
+void
+RequestQueueClassTest::Error (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno)
+{
+  errors++;
+}
+
+bool
+RequestQueueClassTest::Add (uint32_t size, uint8_t tos)
+{
+  Ipv4Header h;
+  h.SetDestination (Ipv4Address ("1.2.3.4"));
+  h.SetTos (tos);
+  QueueEntry e (Create<Packet> (size), h, QueueEntry::UnicastForwardCallback (),
+                MakeCallback (&RequestQueueClassTest::Error, this));
+  return q.Enqueue (e);
+}
+
+void
+RequestQueueClassTest::DoRun ()
+{
+  NS_TEST_EXPECT_MSG_EQ (RequestQueue::GetTrafficClass (0), RequestQueue::BEST_EFFORT, "Default ToS");
+  NS_TEST_EXPECT_MSG_EQ (RequestQueue::GetTrafficClass (0x20), RequestQueue::BACKGROUND, "CS1");
+  NS_TEST_EXPECT_MSG_EQ (RequestQueue::GetTrafficClass (0xb8), RequestQueue::VIDEO, "EF");
+  NS_TEST_EXPECT_MSG_EQ (RequestQueue::GetTrafficClass (0xc0), RequestQueue::VOICE, "CS6");
+  q.SetMaxQueueBytes (4096);
+  q.SetClassWeight (RequestQueue::BEST_EFFORT, 1);
+  q.SetClassWeight (RequestQueue::VOICE, 1);
+  NS_TEST_EXPECT_MSG_EQ (Add (5000, 0), false, "Larger than the budget");
+  NS_TEST_EXPECT_MSG_EQ (errors, 1, "Refused packet reported to its sender");
+  for (uint32_t i = 0; i < 8; ++i)
+    Add (512, 0);
+  NS_TEST_EXPECT_MSG_EQ (q.GetBytes (), 4096, "Budget used up");
+  NS_TEST_EXPECT_MSG_EQ (Add (32, 0xc0), true, "Light class admitted");
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassDrops (RequestQueue::BEST_EFFORT), 2, "Oversized and bulk class packet dropped");
+  for (uint32_t i = 0; i < 8; ++i)
+    Add (512, 0);
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassSize (RequestQueue::VOICE), 1, "Light class kept under bulk load");
+  NS_TEST_EXPECT_MSG_LT_OR_EQ (q.GetBytes (), 4096, "Budget kept");
+
+  // Heavier weight gets a larger share
+  q.SetClassWeight (RequestQueue::VOICE, 4);
+  for (uint32_t i = 0; i < 16; ++i)
+    Add (512, 0xc0);
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassBytes (RequestQueue::BEST_EFFORT), 512, "Weighted share of best effort");
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassBytes (RequestQueue::VOICE), 3584, "Weighted share of voice");
+  NS_TEST_EXPECT_MSG_EQ (Add (512, 0xc0), true, "Class over its share evicts its own oldest packet");
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassBytes (RequestQueue::VOICE), 3584, "Weighted share of voice");
+  NS_TEST_EXPECT_MSG_EQ (Add (3000, 0x20), false, "New packet over its class share refused");
+  NS_TEST_EXPECT_MSG_EQ (q.GetClassDrops (RequestQueue::BACKGROUND), 1, "Refused packet counted");
+  uint32_t drops = 0;
+  for (uint32_t c = 0; c < RequestQueue::CLASSES; ++c)
+    drops += q.GetClassDrops (c);
+  NS_TEST_EXPECT_MSG_EQ (errors, drops, "Every drop reported to its sender");
+}
+//-----------------------------------------------------------------------------
+
 }
 }
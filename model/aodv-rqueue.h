@@ -5,6 +5,7 @@
 #include <vector>
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/simulator.h"
+#include "aodv-flat-hash.h"
 
 
 namespace ns3 {
@@ -65,47 +66,176 @@ private:
  * \brief AODV route request queue
  * 
  * Since AODV is an on demand routing we queue requests while looking for route.
+ *
+ * Entries live in a node pool and are threaded on two intrusive lists: one per traffic
+ * class in arrival (i.e. age) order, and a FIFO per destination, found through a hash map.
+ * A hash set of (packet UID, destination) pairs answers duplicate checks, so that enqueue,
+ * dequeue and drop cost O(1) per packet whatever the queue length.
+ *
+ * The queue is bounded by a number of packets and, optionally, by a number of bytes. When
+ * a new packet does not fit, the most aged packet of the class using the largest share of
+ * the exhausted resource relative to its weight is dropped, so light or heavily weighted
+ * classes are not evicted by bulk traffic. The new packet itself is refused if its own class
+ * is the one over its share.
+ *
+ * Expiration is event driven: deadlines are kept in a min-heap and a single event is
+ * scheduled for the earliest one, so outdated packets are dropped (and their error callback
+ * invoked) exactly when their queue timeout elapses. Heap records of entries that left the
+ * queue otherwise are skipped lazily.
  */
 class RequestQueue
 {
 public:
-  /// Default c-tor
-  RequestQueue (uint32_t maxLen, Time routeToQueueTimeout) :
-    m_maxLen (maxLen), m_queueTimeout (routeToQueueTimeout)
+  /// Traffic classes, mapped from the IP precedence bits of the ToS byte like WMM access categories
+  enum TrafficClass
   {
-  }
+    BACKGROUND = 0,
+    BEST_EFFORT = 1,
+    VIDEO = 2,
+    VOICE = 3,
+    CLASSES = 4,
+  };
+  /// Called with every dropped packet and its traffic class
+  typedef Callback<void, Ptr<const Packet>, uint32_t> DropCallback;
+  /// Default c-tor
+  RequestQueue (uint32_t maxLen, Time routeToQueueTimeout);
+  /// D-tor, cancels pending expiration
+  ~RequestQueue ();
   /// Push entry in queue, if there is no entry with the same packet and destination address in queue.
   bool Enqueue (QueueEntry & entry);
+  /// Same as Enqueue () for an entry that left the queue, it keeps its expire time and is dropped if that passed
+  bool Requeue (QueueEntry & entry);
   /// Return first found (the earliest) entry for given destination
   bool Dequeue (Ipv4Address dst, QueueEntry & entry);
+  /// Append all entries for given destination to entries, in arrival order. \return number of entries appended
+  uint32_t DequeueAll (Ipv4Address dst, std::vector<QueueEntry> & entries);
   /// Remove all packets with destination IP address dst
   void DropPacketWithDst (Ipv4Address dst);
   /// Finds whether a packet with destination dst exists in the queue
   bool Find (Ipv4Address dst);
   /// Number of entries
   uint32_t GetSize ();
+  /// Number of queued bytes
+  uint32_t GetBytes () const { return m_bytes; }
+  /// Traffic class of a packet with given ToS byte
+  static uint32_t GetTrafficClass (uint8_t tos);
   ///\name Fields
   //\{
   uint32_t GetMaxQueueLen () const { return m_maxLen; }
   void SetMaxQueueLen (uint32_t len) { m_maxLen = len; }
+  /// Byte budget, zero means unlimited
+  uint32_t GetMaxQueueBytes () const { return m_maxBytes; }
+  void SetMaxQueueBytes (uint32_t bytes) { m_maxBytes = bytes; }
   Time GetQueueTimeout () const { return m_queueTimeout; }
   void SetQueueTimeout (Time t) { m_queueTimeout = t; }
+  uint32_t GetClassWeight (uint32_t cls) const { return m_classes[cls].m_weight; }
+  void SetClassWeight (uint32_t cls, uint32_t weight) { m_classes[cls].m_weight = weight; }
+  void SetDropCallback (DropCallback cb) { m_dropCallback = cb; }
+  //\}
+  ///\name Per class counters
+  //\{
+  uint32_t GetClassSize (uint32_t cls) const { return m_classes[cls].m_size; }
+  uint32_t GetClassBytes (uint32_t cls) const { return m_classes[cls].m_bytes; }
+  uint32_t GetClassDrops (uint32_t cls) const { return m_classes[cls].m_drops; }
   //\}
 
 private:
-  std::vector<QueueEntry> m_queue;
-  /// Remove all expired entries
-  void Purge ();
+  /// End of list marker
+  static const uint32_t NIL = 0xffffffff;
+  /// Queued entry and its links in the age list of its class and in the destination list
+  struct Node
+  {
+    QueueEntry m_entry;
+    uint32_t m_class;
+    uint32_t m_prevAge;
+    uint32_t m_nextAge;
+    uint32_t m_prevDst;
+    uint32_t m_nextDst;
+    /// Incremented each time the node is released, tells stale deadlines apart
+    uint32_t m_stamp;
+  };
+  /// Expiration record of the deadline heap
+  struct Deadline
+  {
+    Time m_time;
+    uint32_t m_node;
+    uint32_t m_stamp;
+    /// Reversed, so that std heap algorithms keep the earliest deadline on top
+    bool operator< (Deadline const & o) const { return m_time > o.m_time; }
+  };
+  /// Age list and counters of one traffic class
+  struct Class
+  {
+    Class () : m_oldest (NIL), m_newest (NIL), m_size (0), m_bytes (0), m_weight (1), m_drops (0) {}
+    /// Most aged entry (head of the age list)
+    uint32_t m_oldest;
+    /// Most recent entry (tail of the age list)
+    uint32_t m_newest;
+    uint32_t m_size;
+    uint32_t m_bytes;
+    uint32_t m_weight;
+    uint32_t m_drops;
+  };
+  /// FIFO of one destination
+  struct DstList
+  {
+    DstList () : m_head (NIL), m_tail (NIL) {}
+    uint32_t m_head;
+    uint32_t m_tail;
+  };
+  /// Key of the duplicate check
+  static uint64_t MakeUidKey (QueueEntry const & en)
+  {
+    return (uint64_t (en.GetPacket ()->GetUid ()) << 32) | en.GetIpv4Header ().GetDestination ().Get ();
+  }
+  /// Make room for entry, evicting or refusing by class share, and insert it. \return false if refused
+  bool Admit (QueueEntry & entry);
+  /// Link entry at the tail of its class age list and of its destination list, return node index
+  uint32_t Insert (QueueEntry const & entry);
+  /// Whether bytes more would exceed the packet or byte limit
+  bool IsFull (uint32_t bytes) const;
+  /// Class using the largest weighted share of the exhausted resource, counting a new packet of cls and bytes
+  uint32_t SelectVictim (uint32_t cls, uint32_t bytes) const;
+  /// Unlink node from both lists and release it, return its entry
+  QueueEntry Remove (uint32_t node);
+  /// Node pool
+  std::vector<Node> m_nodes;
+  /// Released nodes of the pool
+  std::vector<uint32_t> m_free;
+  /// Traffic classes
+  Class m_classes[CLASSES];
+  /// Destination -> FIFO of its entries
+  FlatHashMap<DstList> m_dstLists;
+  /// (packet UID, destination) of queued entries
+  FlatHashMap<bool> m_uids;
+  /// Number of queued entries
+  uint32_t m_size;
+  /// Number of queued bytes
+  uint32_t m_bytes;
+  /// Deadlines of queued entries, min-heap
+  std::vector<Deadline> m_deadlines;
+  /// Pending expiration event
+  EventId m_expireEvent;
+  /// Time the expiration event is scheduled at
+  Time m_expireTime;
+  /// Drop all entries whose deadline is reached and schedule next expiration
+  void Expire ();
+  /// Pop stale deadlines and schedule expiration event for the earliest live one
+  void ScheduleExpire ();
+  /// Rebuild the heap from queued entries once stale records outnumber them
+  void CompactDeadlines ();
   /// Notify that packet is dropped from queue by timeout
   void Drop (QueueEntry en, std::string reason);
+  /// Drop notification
+  DropCallback m_dropCallback;
   /// The maximum number of packets that we allow a routing protocol to buffer.
   uint32_t m_maxLen;
+  /// The maximum number of bytes that we allow a routing protocol to buffer, zero if unlimited.
+  uint32_t m_maxBytes;
   /// The maximum period of time that a routing protocol is allowed to buffer a packet for, seconds.
   Time m_queueTimeout;
-  static bool IsEqual (QueueEntry en, const Ipv4Address dst) { return (en.GetIpv4Header ().GetDestination () == dst); }
 };
 
-
 }
 }
 
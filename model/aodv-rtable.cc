@@ -3,6 +3,7 @@
 #include <iomanip>
 #include "ns3/simulator.h"
 #include "ns3/log.h"
+#include "ns3/test.h"
 
 NS_LOG_COMPONENT_DEFINE ("MbnRoutingTable");
 
@@ -17,13 +18,12 @@ namespace aodvmesh
 
 RoutingTableEntry::RoutingTableEntry (Ptr<NetDevice> dev, Ipv4Address dst, bool vSeqNo, uint32_t seqNo,
                                       Ipv4InterfaceAddress iface, uint16_t hops, Ipv4Address nextHop, Time lifetime) :
-  m_ackTimer (Timer::CANCEL_ON_DESTROY),
-  m_validSeqNo (vSeqNo), m_seqNo (seqNo), m_hops (hops),
-  m_lifeTime (lifetime + Simulator::Now ()), m_iface (iface), m_flag (VALID),
-  m_reqCount (0), m_blackListState (false), m_blackListTimeout (Simulator::Now ())
+  m_lifeTime ((lifetime + Simulator::Now ()).GetTimeStep ()),
+  m_blackListTimeout (Simulator::Now ().GetTimeStep ()), m_iface (iface), m_dst (dst.Get ()),
+  m_seqNo (seqNo), m_hops (hops), m_flag (VALID), m_reqCount (0), m_validSeqNo (vSeqNo),
+  m_blackListState (false)
 {
   m_ipv4Route = Create<Ipv4Route> ();
-  m_ipv4Route->SetDestination (dst);
   m_ipv4Route->SetGateway (nextHop);
   m_ipv4Route->SetSource (m_iface.GetLocal ());
   m_ipv4Route->SetOutputDevice (dev);
@@ -33,66 +33,49 @@ RoutingTableEntry::~RoutingTableEntry ()
 {
 }
 
+void
+RoutingTableEntry::Unshare ()
+{
+  if (m_ipv4Route->GetReferenceCount () > 1)
+    m_ipv4Route = Create<Ipv4Route> (*m_ipv4Route);
+}
+
 bool
 RoutingTableEntry::InsertPrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  if (!LookupPrecursor (id))
-    {
-      m_precursorList.push_back (id);
-      return true;
-    }
-  else
-    return false;
+  return m_precursors.Insert (id);
 }
 
 bool
 RoutingTableEntry::LookupPrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  for (std::vector<Ipv4Address>::const_iterator i = m_precursorList.begin (); i
-       != m_precursorList.end (); ++i)
-    {
-      if (*i == id)
-        {
-          NS_LOG_LOGIC ("Precursor " << id << " found");
-          return true;
-        }
-    }
-  NS_LOG_LOGIC ("Precursor " << id << " not found");
-  return false;
+  bool found = m_precursors.Contains (id);
+  NS_LOG_LOGIC ("Precursor " << id << (found ? " found" : " not found"));
+  return found;
 }
 
 bool
 RoutingTableEntry::DeletePrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  std::vector<Ipv4Address>::iterator i = std::remove (m_precursorList.begin (),
-                                                      m_precursorList.end (), id);
-  if (i == m_precursorList.end ())
-    {
-      NS_LOG_LOGIC ("Precursor " << id << " not found");
-      return false;
-    }
-  else
-    {
-      NS_LOG_LOGIC ("Precursor " << id << " found");
-      m_precursorList.erase (i, m_precursorList.end ());
-    }
-  return true;
+  bool found = m_precursors.Erase (id);
+  NS_LOG_LOGIC ("Precursor " << id << (found ? " found" : " not found"));
+  return found;
 }
 
 void
 RoutingTableEntry::DeleteAllPrecursors ()
 {
   NS_LOG_FUNCTION (this);
-  m_precursorList.clear ();
+  m_precursors.Clear ();
 }
 
 bool
 RoutingTableEntry::IsPrecursorListEmpty () const
 {
-  return m_precursorList.empty ();
+  return m_precursors.IsEmpty ();
 }
 
 void
@@ -101,17 +84,11 @@ RoutingTableEntry::GetPrecursors (std::vector<Ipv4Address> & prec) const
   NS_LOG_FUNCTION (this);
   if (IsPrecursorListEmpty ())
     return;
-  for (std::vector<Ipv4Address>::const_iterator i = m_precursorList.begin (); i
-       != m_precursorList.end (); ++i)
+  std::vector<Ipv4Address> mine;
+  m_precursors.GetAddresses (mine);
+  for (std::vector<Ipv4Address>::const_iterator i = mine.begin (); i != mine.end (); ++i)
     {
-      bool result = true;
-      for (std::vector<Ipv4Address>::const_iterator j = prec.begin (); j
-           != prec.end (); ++j)
-        {
-          if (*j == *i)
-            result = false;
-        }
-      if (result)
+      if (std::find (prec.begin (), prec.end (), *i) == prec.end ())
         prec.push_back (*i);
     }
 }
@@ -124,14 +101,14 @@ RoutingTableEntry::Invalidate (Time badLinkLifetime)
     return;
   m_flag = INVALID;
   m_reqCount = 0;
-  m_lifeTime = badLinkLifetime + Simulator::Now ();
+  m_lifeTime = (badLinkLifetime + Simulator::Now ()).GetTimeStep ();
 }
 
 void
 RoutingTableEntry::Print (Ptr<OutputStreamWrapper> stream) const
 {
   std::ostream* os = stream->GetStream ();
-  *os << m_ipv4Route->GetDestination () << "\t" << m_ipv4Route->GetGateway ()
+  *os << Ipv4Address (m_dst) << "\t" << m_ipv4Route->GetGateway ()
       << "\t" << m_iface.GetLocal () << "\t";
   switch (m_flag)
     {
@@ -154,17 +131,184 @@ RoutingTableEntry::Print (Ptr<OutputStreamWrapper> stream) const
   *os << "\t";
   *os << std::setiosflags (std::ios::fixed) << 
   std::setiosflags (std::ios::left) << std::setprecision (2) <<
-  std::setw (14) << (m_lifeTime - Simulator::Now ()).GetSeconds ();
+  std::setw (14) << GetLifeTime ().GetSeconds ();
   *os << "\t" << m_hops << "\n";
 }
 
+void
+RoutingTableEntry::Snapshot (SnapshotWriter & writer) const
+{
+  SnapshotRoute r;
+  r.m_dst = m_dst;
+  r.m_nextHop = m_ipv4Route->GetGateway ().Get ();
+  r.m_interface = m_iface.GetLocal ().Get ();
+  r.m_seqNo = m_seqNo;
+  r.m_lifeTime = GetLifeTime ().GetNanoSeconds ();
+  r.m_hops = m_hops;
+  r.m_flag = m_flag;
+  r.m_bits = (m_validSeqNo ? SnapshotRoute::VALID_SEQNO : 0) | (m_blackListState ? SnapshotRoute::UNIDIRECTIONAL : 0);
+  r.m_precursors = std::min<uint32_t> (m_precursors.GetSize (), 0xffff);
+  writer.AddRoute (r);
+}
+
 /*
  The Routing Table
  */
 
 RoutingTable::RoutingTable (Time t) : 
-  m_badLinkLifetime (t)
+  m_routesSwept (0), m_cacheHits (0), m_cacheMisses (0), m_badLinkLifetime (t)
+{
+}
+
+RoutingTable::~RoutingTable ()
+{
+  for (uint32_t i = 0; i < m_ackTimers.GetCapacity (); ++i)
+    if (m_ackTimers.IsUsed (i))
+      m_ackTimers.GetValue (i).Cancel ();
+}
+
+uint32_t
+RoutingTable::FindSlot (Ipv4Address dst) const
+{
+  const uint32_t * slot = m_index.Find (dst.Get ());
+  return slot ? *slot : 0xffffffff;
+}
+
+void
+RoutingTable::EraseSlot (uint32_t slot)
+{
+  m_index.Erase (m_slots[slot].m_entry.GetDestination ().Get ());
+  Unlink (slot, BY_NEXT_HOP);
+  Unlink (slot, BY_INTERFACE);
+  m_slots[slot].m_used = false;
+  m_slots[slot].m_generation++;
+  m_slots[slot].m_armed = false;
+  m_slots[slot].m_parked = false;
+  CancelAckTimer (m_slots[slot].m_entry.GetDestination ());
+  // Drop references to route and device held by the released entry
+  m_slots[slot].m_entry = RoutingTableEntry ();
+  m_freeSlots.push_back (slot);
+}
+
+void
+RoutingTable::Clear ()
+{
+  // Release rather than drop the slots, so handles taken before stay stale
+  m_freeSlots.clear ();
+  for (uint32_t slot = 0; slot < m_slots.size (); ++slot)
+    {
+      if (m_slots[slot].m_used)
+        {
+          m_slots[slot].m_used = false;
+          m_slots[slot].m_generation++;
+          m_slots[slot].m_armed = false;
+          m_slots[slot].m_parked = false;
+          m_slots[slot].m_entry = RoutingTableEntry ();
+        }
+      m_freeSlots.push_back (slot);
+    }
+  m_index.Clear ();
+  m_expiries.clear ();
+  m_parked.clear ();
+  for (uint32_t i = 0; i < LIST_INDEXES; ++i)
+    m_listHeads[i].Clear ();
+  for (uint32_t i = 0; i < m_ackTimers.GetCapacity (); ++i)
+    if (m_ackTimers.IsUsed (i))
+      m_ackTimers.GetValue (i).Cancel ();
+  m_ackTimers.Clear ();
+  m_routes.clear ();
+  m_routesSwept = 0;
+}
+
+uint32_t
+RoutingTable::GetListKey (uint32_t slot, ListIndex index) const
+{
+  RoutingTableEntry const & entry = m_slots[slot].m_entry;
+  return index == BY_NEXT_HOP ? entry.GetNextHop ().Get () : entry.GetInterface ().GetLocal ().Get ();
+}
+
+void
+RoutingTable::Link (uint32_t slot, ListIndex index)
+{
+  ListLink & link = m_slots[slot].m_links[index];
+  link.m_key = GetListKey (slot, index);
+  link.m_prev = 0xffffffff;
+  bool inserted;
+  uint32_t * head = m_listHeads[index].Insert (link.m_key, slot, &inserted);
+  if (inserted)
+    link.m_next = 0xffffffff;
+  else
+    {
+      link.m_next = *head;
+      m_slots[*head].m_links[index].m_prev = slot;
+      *head = slot;
+    }
+}
+
+void
+RoutingTable::Unlink (uint32_t slot, ListIndex index)
+{
+  ListLink & link = m_slots[slot].m_links[index];
+  if (link.m_prev != 0xffffffff)
+    m_slots[link.m_prev].m_links[index].m_next = link.m_next;
+  else if (link.m_next != 0xffffffff)
+    *m_listHeads[index].Find (link.m_key) = link.m_next;
+  else
+    m_listHeads[index].Erase (link.m_key);
+  if (link.m_next != 0xffffffff)
+    m_slots[link.m_next].m_links[index].m_prev = link.m_prev;
+}
+
+void
+RoutingTable::Relink (uint32_t slot)
 {
+  for (uint32_t i = 0; i < LIST_INDEXES; ++i)
+    {
+      ListIndex index = static_cast<ListIndex> (i);
+      if (m_slots[slot].m_links[i].m_key != GetListKey (slot, index))
+        {
+          Unlink (slot, index);
+          Link (slot, index);
+        }
+    }
+}
+
+void
+RoutingTable::Arm (uint32_t slot)
+{
+  Slot & s = m_slots[slot];
+  Time deadline = Simulator::Now () + s.m_entry.GetLifeTime ();
+  if (s.m_armed && s.m_deadline == deadline)
+    return;
+  s.m_deadline = deadline;
+  s.m_armed = true;
+  Expiry e;
+  e.m_time = deadline;
+  e.m_slot = slot;
+  e.m_generation = s.m_generation;
+  m_expiries.push_back (e);
+  std::push_heap (m_expiries.begin (), m_expiries.end ());
+}
+
+bool
+RoutingTable::IsLive (Expiry const & e) const
+{
+  Slot const & s = m_slots[e.m_slot];
+  return s.m_used && s.m_generation == e.m_generation && s.m_armed && s.m_deadline == e.m_time;
+}
+
+void
+RoutingTable::CompactExpiries ()
+{
+  std::vector<Expiry> live;
+  live.reserve (m_index.GetSize ());
+  for (std::vector<Expiry>::const_iterator i = m_expiries.begin (); i != m_expiries.end (); ++i)
+    {
+      if (IsLive (*i))
+        live.push_back (*i);
+    }
+  std::make_heap (live.begin (), live.end ());
+  m_expiries.swap (live);
 }
 
 bool
@@ -172,19 +316,18 @@ RoutingTable::LookupRoute (Ipv4Address id, RoutingTableEntry & rt)
 {
   NS_LOG_FUNCTION (this << id);
   Purge ();
-  if (m_ipv4AddressEntry.empty ())
+  if (m_index.GetSize () == 0)
     {
-      NS_LOG_LOGIC ("Route to " << id << " not found; m_ipv4AddressEntry is empty");
+      NS_LOG_LOGIC ("Route to " << id << " not found; routing table is empty");
       return false;
     }
-  std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
-    m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
     {
       NS_LOG_LOGIC ("Route to " << id << " not found");
       return false;
     }
-  rt = i->second;
+  rt = m_slots[slot].m_entry;
   NS_LOG_LOGIC ("Route to " << id << " found");
   return true;
 }
@@ -202,13 +345,93 @@ RoutingTable::LookupValidRoute (Ipv4Address id, RoutingTableEntry & rt)
   return (rt.GetFlag () == VALID);
 }
 
+RoutingTableEntry *
+RoutingTable::LookupRoute (Ipv4Address id)
+{
+  NS_LOG_FUNCTION (this << id);
+  Purge ();
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
+    {
+      NS_LOG_LOGIC ("Route to " << id << " not found");
+      return 0;
+    }
+  NS_LOG_LOGIC ("Route to " << id << " found");
+  CacheLine & line = GetCacheLine (id);
+  line.m_dst = id.Get ();
+  line.m_slot = slot;
+  line.m_generation = m_slots[slot].m_generation;
+  line.m_version = m_slots[slot].m_version;
+  return &m_slots[slot].m_entry;
+}
+
+RoutingTableEntry *
+RoutingTable::LookupValidRoute (Ipv4Address id)
+{
+  NS_LOG_FUNCTION (this << id);
+  RoutingTableEntry * rt = LookupCachedRoute (id);
+  if (rt)
+    return rt;
+  rt = LookupRoute (id);
+  if (rt == 0 || rt->GetFlag () != VALID)
+    return 0;
+  return rt;
+}
+
+RoutingTableEntry *
+RoutingTable::LookupCachedRoute (Ipv4Address id)
+{
+  CacheLine const & line = GetCacheLine (id);
+  if (line.m_dst == id.Get () && line.m_slot < m_slots.size ())
+    {
+      Slot & s = m_slots[line.m_slot];
+      // An entry past its lifetime is left to the purge of the table lookup
+      if (s.m_generation == line.m_generation && s.m_version == line.m_version
+          && s.m_entry.GetFlag () == VALID && s.m_entry.GetLifeTime () >= Seconds (0))
+        {
+          m_cacheHits++;
+          return &s.m_entry;
+        }
+    }
+  m_cacheMisses++;
+  return 0;
+}
+
+bool
+RoutingTable::LookupHandle (Ipv4Address id, Handle & handle)
+{
+  NS_LOG_FUNCTION (this << id);
+  Purge ();
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
+    {
+      NS_LOG_LOGIC ("Route to " << id << " not found");
+      return false;
+    }
+  handle.m_slot = slot;
+  handle.m_generation = m_slots[slot].m_generation;
+  return true;
+}
+
+RoutingTableEntry *
+RoutingTable::GetEntry (Handle handle)
+{
+  if (handle.m_slot >= m_slots.size ()
+      || !m_slots[handle.m_slot].m_used
+      || m_slots[handle.m_slot].m_generation != handle.m_generation)
+    return 0;
+  return &m_slots[handle.m_slot].m_entry;
+}
+
 bool
 RoutingTable::DeleteRoute (Ipv4Address dst)
 {
   NS_LOG_FUNCTION (this << dst);
   Purge ();
-  if (m_ipv4AddressEntry.erase (dst) != 0)
+  uint32_t slot = FindSlot (dst);
+  if (slot != 0xffffffff)
     {
+      EraseSlot (slot);
       NS_LOG_LOGIC ("Route deletion to " << dst << " successful");
       return true;
     }
@@ -223,28 +446,58 @@ RoutingTable::AddRoute (RoutingTableEntry & rt)
   Purge ();
   if (rt.GetFlag () != IN_SEARCH)
     rt.SetRreqCnt (0);
-  std::pair<std::map<Ipv4Address, RoutingTableEntry>::iterator, bool> result =
-    m_ipv4AddressEntry.insert (std::make_pair (rt.GetDestination (), rt));
-  return result.second;
+  uint32_t slot = m_freeSlots.empty () ? m_slots.size () : m_freeSlots.back ();
+  bool inserted;
+  m_index.Insert (rt.GetDestination ().Get (), slot, &inserted);
+  if (!inserted)
+    return false;
+  if (slot == m_slots.size ())
+    {
+      Slot s;
+      s.m_entry = rt;
+      s.m_generation = 0;
+      s.m_version = 0;
+      s.m_used = true;
+      s.m_armed = false;
+      s.m_parked = false;
+      m_slots.push_back (s);
+    }
+  else
+    {
+      m_freeSlots.pop_back ();
+      m_slots[slot].m_entry = rt;
+      m_slots[slot].m_used = true;
+    }
+  Intern (slot);
+  Link (slot, BY_NEXT_HOP);
+  Link (slot, BY_INTERFACE);
+  Arm (slot);
+  return true;
 }
 
 bool
 RoutingTable::Update (RoutingTableEntry & rt)
 {
   NS_LOG_FUNCTION (this);
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (rt.GetDestination ());
-  if (i == m_ipv4AddressEntry.end ())
+  uint32_t slot = FindSlot (rt.GetDestination ());
+  if (slot == 0xffffffff)
     {
       NS_LOG_LOGIC ("Route update to " << rt.GetDestination () << " fails; not found");
       return false;
     }
-  i->second = rt;
-  if (i->second.GetFlag () != IN_SEARCH)
+  RoutingTableEntry & entry = m_slots[slot].m_entry;
+  if (entry.GetFlag () != rt.GetFlag () || entry.GetNextHop () != rt.GetNextHop ()
+      || entry.GetOutputDevice () != rt.GetOutputDevice ())
+    m_slots[slot].m_version++;
+  entry = rt;
+  if (entry.GetFlag () != IN_SEARCH)
     {
       NS_LOG_LOGIC ("Route update to " << rt.GetDestination () << " set RreqCnt to 0");
-      i->second.SetRreqCnt (0);
+      entry.SetRreqCnt (0);
     }
+  Intern (slot);
+  Relink (slot);
+  Arm (slot);
   return true;
 }
 
@@ -252,33 +505,169 @@ bool
 RoutingTable::SetEntryState (Ipv4Address id, RouteFlags state)
 {
   NS_LOG_FUNCTION (this);
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
     {
       NS_LOG_LOGIC ("Route set entry state to " << id << " fails; not found");
       return false;
     }
-  i->second.SetFlag (state);
-  i->second.SetRreqCnt (0);
+  m_slots[slot].m_entry.SetFlag (state);
+  m_slots[slot].m_entry.SetRreqCnt (0);
+  m_slots[slot].m_version++;
   NS_LOG_LOGIC ("Route set entry state to " << id << ": new state is " << state);
   return true;
 }
 
+bool
+RoutingTable::UpdateLifeTime (Ipv4Address id, Time lifetime)
+{
+  NS_LOG_FUNCTION (this << id << lifetime);
+  return UpdateLifeTime (LookupValidRoute (id), lifetime);
+}
+
+bool
+RoutingTable::UpdateLifeTime (RoutingTableEntry * rt, Time lifetime)
+{
+  if (rt == 0 || rt->GetFlag () != VALID)
+    return false;
+  NS_LOG_DEBUG ("Updating VALID route");
+  rt->SetRreqCnt (0);
+  // Only the entry is touched, the expiry heap picks the new lifetime up when the old deadline pops
+  rt->SetLifeTime (std::max (lifetime, rt->GetLifeTime ()));
+  return true;
+}
+
+bool
+RoutingTable::SetNextHop (Ipv4Address id, Ipv4Address nextHop)
+{
+  NS_LOG_FUNCTION (this << id << nextHop);
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
+    {
+      NS_LOG_LOGIC ("Route set next hop to " << id << " fails; not found");
+      return false;
+    }
+  m_slots[slot].m_entry.SetNextHop (nextHop);
+  m_slots[slot].m_version++;
+  Intern (slot);
+  Relink (slot);
+  return true;
+}
+
+bool
+RoutingTable::SetInterface (Ipv4Address id, Ipv4InterfaceAddress iface)
+{
+  NS_LOG_FUNCTION (this << id << iface);
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
+    {
+      NS_LOG_LOGIC ("Route set interface to " << id << " fails; not found");
+      return false;
+    }
+  m_slots[slot].m_entry.SetInterface (iface);
+  Intern (slot);
+  Relink (slot);
+  return true;
+}
+
+bool
+RoutingTable::SetOutputDevice (Ipv4Address id, Ptr<NetDevice> dev, Ipv4InterfaceAddress iface)
+{
+  NS_LOG_FUNCTION (this << id << iface);
+  uint32_t slot = FindSlot (id);
+  if (slot == 0xffffffff)
+    {
+      NS_LOG_LOGIC ("Route set output device to " << id << " fails; not found");
+      return false;
+    }
+  RoutingTableEntry & entry = m_slots[slot].m_entry;
+  if (entry.GetOutputDevice () == dev && entry.GetInterface () == iface)
+    return true;
+  entry.SetOutputDevice (dev);
+  entry.SetInterface (iface);
+  m_slots[slot].m_version++;
+  Intern (slot);
+  Relink (slot);
+  return true;
+}
+
+void
+RoutingTable::Intern (uint32_t slot)
+{
+  RoutingTableEntry & entry = m_slots[slot].m_entry;
+  Ptr<Ipv4Route> route = entry.GetRoute ();
+  RouteKey key (*route);
+  std::map<RouteKey, Ptr<Ipv4Route> >::iterator i = m_routes.find (key);
+  if (i == m_routes.end ())
+    {
+      if (m_routes.size () >= 2 * m_routesSwept + 16)
+        SweepRoutes ();
+      // Entry routes carry no destination, so the entry's own route can be shared as is
+      m_routes.insert (std::make_pair (key, route));
+      return;
+    }
+  if (i->second != route)
+    entry.SetRoute (i->second);
+}
+
+void
+RoutingTable::SweepRoutes ()
+{
+  std::map<RouteKey, Ptr<Ipv4Route> >::iterator i = m_routes.begin ();
+  while (i != m_routes.end ())
+    {
+      if (i->second->GetReferenceCount () == 1)
+        m_routes.erase (i++);
+      else
+        ++i;
+    }
+  m_routesSwept = m_routes.size ();
+}
+
+bool
+RoutingTable::SetAckTimer (Ipv4Address id, EventId event)
+{
+  if (FindSlot (id) == 0xffffffff)
+    {
+      event.Cancel ();
+      return false;
+    }
+  bool inserted;
+  EventId * timer = m_ackTimers.Insert (id.Get (), event, &inserted);
+  if (!inserted)
+    {
+      timer->Cancel ();
+      *timer = event;
+    }
+  return true;
+}
+
+void
+RoutingTable::CancelAckTimer (Ipv4Address id)
+{
+  if (m_ackTimers.GetSize () == 0)
+    return;
+  EventId * timer = m_ackTimers.Find (id.Get ());
+  if (timer == 0)
+    return;
+  timer->Cancel ();
+  m_ackTimers.Erase (id.Get ());
+}
+
 void
 RoutingTable::GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, uint32_t> & unreachable )
 {
   NS_LOG_FUNCTION (this);
   Purge ();
   unreachable.clear ();
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); ++i)
+  uint32_t const * head = m_listHeads[BY_NEXT_HOP].Find (nextHop.Get ());
+  for (uint32_t i = head ? *head : 0xffffffff; i != 0xffffffff; i = m_slots[i].m_links[BY_NEXT_HOP].m_next)
     {
-      if (i->second.GetNextHop () == nextHop)
-        {
-          NS_LOG_LOGIC ("Unreachable insert " << i->first << " " << i->second.GetSeqNo ());
-          unreachable.insert (std::make_pair (i->first, i->second.GetSeqNo ()));
-        }
+      RoutingTableEntry const & entry = m_slots[i].m_entry;
+      if (entry.GetNextHop () != nextHop)
+        continue;
+      NS_LOG_LOGIC ("Unreachable insert " << entry.GetDestination () << " " << entry.GetSeqNo ());
+      unreachable.insert (std::make_pair (entry.GetDestination (), entry.GetSeqNo ()));
     }
 }
 
@@ -287,17 +676,16 @@ RoutingTable::InvalidateRoutesWithDst (const std::map<Ipv4Address, uint32_t> & u
 {
   NS_LOG_FUNCTION (this);
   Purge ();
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); ++i)
+  for (std::map<Ipv4Address, uint32_t>::const_iterator j =
+         unreachable.begin (); j != unreachable.end (); ++j)
     {
-      for (std::map<Ipv4Address, uint32_t>::const_iterator j =
-             unreachable.begin (); j != unreachable.end (); ++j)
+      uint32_t slot = FindSlot (j->first);
+      if (slot != 0xffffffff && m_slots[slot].m_entry.GetFlag () == VALID)
         {
-          if ((i->first == j->first) && (i->second.GetFlag () == VALID))
-            {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-            }
+          NS_LOG_LOGIC ("Invalidate route with destination address " << j->first);
+          m_slots[slot].m_entry.Invalidate (m_badLinkLifetime);
+          m_slots[slot].m_version++;
+          Arm (slot);
         }
     }
 }
@@ -306,19 +694,15 @@ void
 RoutingTable::DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface)
 {
   NS_LOG_FUNCTION (this);
-  if (m_ipv4AddressEntry.empty ())
-    return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end ();)
+  uint32_t const * head = m_listHeads[BY_INTERFACE].Find (iface.GetLocal ().Get ());
+  uint32_t i = head ? *head : 0xffffffff;
+  while (i != 0xffffffff)
     {
-      if (i->second.GetInterface () == iface)
-        {
-          std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-          ++i;
-          m_ipv4AddressEntry.erase (tmp);
-        }
-      else
-        ++i;
+      // Erasing unlinks the slot, so step before that
+      uint32_t next = m_slots[i].m_links[BY_INTERFACE].m_next;
+      if (m_slots[i].m_entry.GetInterface () == iface)
+        EraseSlot (i);
+      i = next;
     }
 }
 
@@ -326,100 +710,176 @@ void
 RoutingTable::Purge ()
 {
   NS_LOG_FUNCTION (this);
-  if (m_ipv4AddressEntry.empty ())
-    return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end ();)
+  // Expired IN_SEARCH entries become due again once their state or lifetime changes
+  for (uint32_t i = 0; i < m_parked.size (); )
     {
-      if (i->second.GetLifeTime () < Seconds (0))
+      RoutingTableEntry * entry = GetEntry (m_parked[i]);
+      if (entry && entry->GetFlag () == IN_SEARCH && entry->GetLifeTime () < Seconds (0))
         {
-          if (i->second.GetFlag () == INVALID)
-            {
-              std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-              ++i;
-              m_ipv4AddressEntry.erase (tmp);
-            }
-          else if (i->second.GetFlag () == VALID)
-            {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-              ++i;
-            }
-          else
-            ++i;
+          ++i;
+          continue;
         }
-      else 
+      if (entry)
         {
-          ++i;
+          m_slots[m_parked[i].m_slot].m_parked = false;
+          Arm (m_parked[i].m_slot);
         }
+      m_parked[i] = m_parked.back ();
+      m_parked.pop_back ();
     }
-}
-
-void
-RoutingTable::Purge (std::map<Ipv4Address, RoutingTableEntry> &table) const
-{
-  NS_LOG_FUNCTION (this);
-  if (table.empty ())
-    return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         table.begin (); i != table.end ();)
+  while (!m_expiries.empty () && m_expiries.front ().m_time < Simulator::Now ())
     {
-      if (i->second.GetLifeTime () < Seconds (0))
+      Expiry e = m_expiries.front ();
+      std::pop_heap (m_expiries.begin (), m_expiries.end ());
+      m_expiries.pop_back ();
+      if (!IsLive (e))
+        continue;
+      Slot & s = m_slots[e.m_slot];
+      s.m_armed = false;
+      RoutingTableEntry & entry = s.m_entry;
+      if (entry.GetLifeTime () >= Seconds (0))
         {
-          if (i->second.GetFlag () == INVALID)
-            {
-              std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-              ++i;
-              table.erase (tmp);
-            }
-          else if (i->second.GetFlag () == VALID)
-            {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-              ++i;
-            }
-          else
-            ++i;
+          // Lifetime was extended in place
+          Arm (e.m_slot);
         }
-      else 
+      else if (entry.GetFlag () == INVALID)
+        EraseSlot (e.m_slot);
+      else if (entry.GetFlag () == VALID)
         {
-          ++i;
+          NS_LOG_LOGIC ("Invalidate route with destination address " << entry.GetDestination ());
+          entry.Invalidate (m_badLinkLifetime);
+          s.m_version++;
+          Arm (e.m_slot);
+        }
+      else if (!s.m_parked)
+        {
+          s.m_parked = true;
+          Handle h;
+          h.m_slot = e.m_slot;
+          h.m_generation = s.m_generation;
+          m_parked.push_back (h);
         }
     }
+  if (m_expiries.size () > 2 * m_index.GetSize () + 64)
+    CompactExpiries ();
 }
 
 bool
 RoutingTable::MarkLinkAsUnidirectional (Ipv4Address neighbor, Time blacklistTimeout)
 {
   NS_LOG_FUNCTION (this << neighbor << blacklistTimeout.GetSeconds ());
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (neighbor);
-  if (i == m_ipv4AddressEntry.end ())
+  uint32_t slot = FindSlot (neighbor);
+  if (slot == 0xffffffff)
     {
       NS_LOG_LOGIC ("Mark link unidirectional to  " << neighbor << " fails; not found");
       return false;
     }
-  i->second.SetUnidirectional (true);
-  i->second.SetBalcklistTimeout (blacklistTimeout);
-  i->second.SetRreqCnt (0);
+  RoutingTableEntry & entry = m_slots[slot].m_entry;
+  entry.SetUnidirectional (true);
+  entry.SetBalcklistTimeout (blacklistTimeout);
+  entry.SetRreqCnt (0);
   NS_LOG_LOGIC ("Set link to " << neighbor << " to unidirectional");
   return true;
 }
 
+/// Order entries by destination address, as printed
+static bool
+DestinationLess (RoutingTableEntry const & a, RoutingTableEntry const & b)
+{
+  return a.GetDestination () < b.GetDestination ();
+}
+
 void
 RoutingTable::Print (Ptr<OutputStreamWrapper> stream) const
 {
-  std::map<Ipv4Address, RoutingTableEntry> table = m_ipv4AddressEntry;
-  Purge (table);
+  // Print the table as Purge () would leave it, without modifying it
+  std::vector<RoutingTableEntry> table;
+  table.reserve (m_index.GetSize ());
+  for (std::vector<Slot>::const_iterator i = m_slots.begin (); i != m_slots.end (); ++i)
+    {
+      if (!i->m_used)
+        continue;
+      if (i->m_entry.GetLifeTime () < Seconds (0) && i->m_entry.GetFlag () == INVALID)
+        continue;
+      table.push_back (i->m_entry);
+      if (i->m_entry.GetLifeTime () < Seconds (0) && i->m_entry.GetFlag () == VALID)
+        table.back ().Invalidate (m_badLinkLifetime);
+    }
+  std::sort (table.begin (), table.end (), DestinationLess);
   *stream->GetStream () << "\nAODVMESH Routing table\n"
                         << "Destination\tGateway\t\tInterface\tFlag\tExpire\t\tHops\n";
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
+  for (std::vector<RoutingTableEntry>::const_iterator i =
          table.begin (); i != table.end (); ++i)
     {
-      i->second.Print (stream);
+      i->Print (stream);
     }
   *stream->GetStream () << "\n";
 }
 
+void
+RoutingTable::Snapshot (SnapshotWriter & writer) const
+{
+  for (std::vector<Slot>::const_iterator i = m_slots.begin (); i != m_slots.end (); ++i)
+    {
+      if (!i->m_used)
+        continue;
+      bool expired = i->m_entry.GetLifeTime () < Seconds (0);
+      if (expired && i->m_entry.GetFlag () == INVALID)
+        continue;
+      if (expired && i->m_entry.GetFlag () == VALID)
+        {
+          RoutingTableEntry invalid = i->m_entry;
+          invalid.Invalidate (m_badLinkLifetime);
+          invalid.Snapshot (writer);
+        }
+      else
+        i->m_entry.Snapshot (writer);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for the route cache
+struct RouteCacheTest : public TestCase
+{
+  RouteCacheTest () : TestCase ("Route cache")
+  {}
+  virtual void DoRun ();
+};
+
+void
+RouteCacheTest::DoRun ()
+{
+  RoutingTable table (Seconds (5));
+  Ipv4Address dst ("10.0.0.5");
+  RoutingTableEntry rt (/*dev=*/ 0, dst, /*vSeqNo=*/ true, /*seqNo=*/ 1, Ipv4InterfaceAddress (), /*hops=*/ 2,
+                        /*nextHop=*/ Ipv4Address ("10.0.0.2"), /*lifetime=*/ Seconds (10));
+  table.AddRoute (rt);
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == 0, true, "Not looked up yet");
+  RoutingTableEntry * entry = table.LookupRoute (dst);
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == entry, true, "Hit after table lookup");
+  NS_TEST_EXPECT_MSG_EQ (table.GetCacheHits (), 1, "One hit");
+  NS_TEST_EXPECT_MSG_EQ (table.GetCacheMisses (), 1, "One miss");
+
+  table.SetNextHop (dst, Ipv4Address ("10.0.0.3"));
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == 0, true, "Next hop change");
+  entry = table.LookupValidRoute (dst);
+  NS_TEST_EXPECT_MSG_EQ (entry != 0 && table.LookupCachedRoute (dst) == entry, true, "Filled again");
+  table.SetEntryState (dst, IN_SEARCH);
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == 0, true, "State change");
+  table.SetEntryState (dst, VALID);
+  entry = table.LookupRoute (dst);
+  entry->SetLifeTime (Seconds (-1));
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == 0, true, "Lifetime passed");
+
+  table.DeleteRoute (dst);
+  table.AddRoute (rt);
+  NS_TEST_EXPECT_MSG_EQ (table.LookupCachedRoute (dst) == 0, true, "Route deleted and added again");
+  Simulator::Destroy ();
+}
+//-----------------------------------------------------------------------------
+
 }
 }
+
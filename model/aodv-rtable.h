@@ -8,9 +8,13 @@
 #include <sys/types.h>
 #include "ns3/ipv4.h"
 #include "ns3/ipv4-route.h"
-#include "ns3/timer.h"
+#include "ns3/simulator.h"
+#include "ns3/event-id.h"
 #include "ns3/net-device.h"
 #include "ns3/output-stream-wrapper.h"
+#include "aodv-flat-hash.h"
+#include "aodv-precursor-set.h"
+#include "aodv-snapshot.h"
 
 namespace ns3 {
 namespace aodvmesh {
@@ -29,6 +33,10 @@ enum RouteFlags
 /**
  * \ingroup aodvmesh
  * \brief Routing table entry
+ *
+ * Times are kept as absolute time steps. The Ipv4Route is shared by every routing table entry
+ * with the same next hop, output device and source, and carries no destination; setters copy it
+ * before modifying it if it is shared.
  */
 class RoutingTableEntry
 {
@@ -71,18 +79,26 @@ public:
    * Inserts precursors in vector prec if they does not yet exist in vector
    */
   void GetPrecursors (std::vector<Ipv4Address> & prec) const;
+  /// Inserts precursors in set prec, without rescanning it. Use to collect precursors of many routes
+  void GetPrecursors (PrecursorSet & prec) const { prec.Union (m_precursors); }
   //\}
 
   /// Mark entry as "down" (i.e. disable it)
   void Invalidate (Time badLinkLifetime);
   ///\name Fields
   //\{
-  Ipv4Address GetDestination () const { return m_ipv4Route->GetDestination (); }
+  Ipv4Address GetDestination () const { return Ipv4Address (m_dst); }
   Ptr<Ipv4Route> GetRoute () const { return m_ipv4Route; }
   void SetRoute (Ptr<Ipv4Route> r) { m_ipv4Route = r; }
-  void SetNextHop (Ipv4Address nextHop) { m_ipv4Route->SetGateway (nextHop); }
+  void SetNextHop (Ipv4Address nextHop) { Unshare (); m_ipv4Route->SetGateway (nextHop); }
   Ipv4Address GetNextHop () const { return m_ipv4Route->GetGateway (); }
-  void SetOutputDevice (Ptr<NetDevice> dev) { m_ipv4Route->SetOutputDevice (dev); }
+  void SetOutputDevice (Ptr<NetDevice> dev)
+  {
+    if (m_ipv4Route->GetOutputDevice () == dev)
+      return;
+    Unshare ();
+    m_ipv4Route->SetOutputDevice (dev);
+  }
   Ptr<NetDevice> GetOutputDevice () const { return m_ipv4Route->GetOutputDevice (); }
   Ipv4InterfaceAddress GetInterface () const { return m_iface; }
   void SetInterface (Ipv4InterfaceAddress iface) { m_iface = iface; }
@@ -92,19 +108,17 @@ public:
   uint32_t GetSeqNo () const { return m_seqNo; }
   void SetHop (uint16_t hop) { m_hops = hop; }
   uint16_t GetHop () const { return m_hops; }
-  void SetLifeTime (Time lt) { m_lifeTime = lt + Simulator::Now (); }
-  Time GetLifeTime () const { return m_lifeTime - Simulator::Now (); }
+  void SetLifeTime (Time lt) { m_lifeTime = (lt + Simulator::Now ()).GetTimeStep (); }
+  Time GetLifeTime () const { return TimeStep (m_lifeTime) - Simulator::Now (); }
   void SetFlag (RouteFlags flag) { m_flag = flag; }
-  RouteFlags GetFlag () const { return m_flag; }
+  RouteFlags GetFlag () const { return RouteFlags (m_flag); }
   void SetRreqCnt (uint8_t n) { m_reqCount = n; }
   uint8_t GetRreqCnt () const { return m_reqCount; }
   void IncrementRreqCnt () { m_reqCount++; }
   void SetUnidirectional (bool u) { m_blackListState = u; }
   bool IsUnidirectional () const { return m_blackListState; }
-  void SetBalcklistTimeout (Time t) { m_blackListTimeout = t; }
-  Time GetBlacklistTimeout () const { return m_blackListTimeout; }
-  /// RREP_ACK timer
-  Timer m_ackTimer;
+  void SetBalcklistTimeout (Time t) { m_blackListTimeout = t.GetTimeStep (); }
+  Time GetBlacklistTimeout () const { return TimeStep (m_blackListTimeout); }
   //\}
 
   /**
@@ -113,57 +127,91 @@ public:
    */
   bool operator== (Ipv4Address const  dst) const
   {
-    return (m_ipv4Route->GetDestination () == dst);
+    return (Ipv4Address (m_dst) == dst);
   }
   void Print (Ptr<OutputStreamWrapper> stream) const;
+  /// Append entry to snapshot record
+  void Snapshot (SnapshotWriter & writer) const;
 
 private:
-  /// Valid Destination Sequence Number flag
-  bool m_validSeqNo;
-  /// Destination Sequence Number, if m_validSeqNo = true
-  uint32_t m_seqNo;
-  /// Hop Count (number of hops needed to reach destination)
-  uint16_t m_hops;
-  /**
-  * \brief Expiration or deletion time of the route
-  *	Lifetime field in the routing table plays dual role --
-  *	for an active route it is the expiration time, and for an invalid route
-  *	it is the deletion time.
-  */
-  Time m_lifeTime;
+  /// Give the entry its own copy of a shared route before modifying it
+  void Unshare ();
+
   /** Ip route, include
-  *   - destination address
   *   - source address
   *   - next hop address (gateway)
   *   - output device
   */
   Ptr<Ipv4Route> m_ipv4Route;
+  /**
+  * \brief Expiration or deletion time of the route, in time steps
+  *	Lifetime field in the routing table plays dual role --
+  *	for an active route it is the expiration time, and for an invalid route
+  *	it is the deletion time.
+  */
+  int64_t m_lifeTime;
+  /// Time for which the node is put into the blacklist, in time steps
+  int64_t m_blackListTimeout;
+  /// Set of precursors
+  PrecursorSet m_precursors;
   /// Output interface address
   Ipv4InterfaceAddress m_iface;
+  /// Destination address
+  uint32_t m_dst;
+  /// Destination Sequence Number, if m_validSeqNo = true
+  uint32_t m_seqNo;
+  /// Hop Count (number of hops needed to reach destination)
+  uint16_t m_hops;
   /// Routing flags: valid, invalid or in search
-  RouteFlags m_flag;
-
-  /// List of precursors
-  std::vector<Ipv4Address> m_precursorList;
-  /// When I can send another request
-  Time m_routeRequestTimout;
+  uint8_t m_flag;
   /// Number of route requests
   uint8_t m_reqCount;
+  /// Valid Destination Sequence Number flag
+  bool m_validSeqNo;
   /// Indicate if this entry is in "blacklist"
   bool m_blackListState;
-  /// Time for which the node is put into the blacklist
-  Time m_blackListTimeout;
 };
 
 /**
  * \ingroup aodvmesh
  * \brief The Routing table used by AODVMESH protocol
+ *
+ * Entries are stored in a slot array and found through an open addressing hash index keyed
+ * on the destination address, so lookups touch one or two cache lines and full table walks
+ * are contiguous scans. A slot keeps its entry until the route is deleted, which makes
+ * handles stable across insertions and deletions of other routes.
+ *
+ * Route deadlines are kept in a min-heap with lazy deletion, so Purge only visits entries whose
+ * lifetime has passed. Entries returned by pointer may have their lifetime extended in place;
+ * anything that shortens a lifetime must go through the table (AddRoute, Update,
+ * InvalidateRoutesWithDst).
+ *
+ * Entries are also linked into per next hop and per interface lists, so link breaks and
+ * interface removal visit the affected routes only. Next hop and interface changes must
+ * likewise go through the table (AddRoute, Update, SetNextHop, SetInterface, SetOutputDevice).
+ *
+ * Entries in the table share their Ipv4Route with all entries with the same next hop, output
+ * device and source. RREP_ACK timers are kept in a side table, only while they are armed.
+ *
+ * The last pointer lookup of each destination is remembered in a small direct-mapped cache, so
+ * per packet lookups of a stable route skip the index and the purge. A line holds the slot
+ * generation, which changes when the route is added or deleted, and the slot version, which
+ * changes with the state, next hop or output device of the route through the table. A hit also
+ * requires the entry to be VALID and within its lifetime.
  */
 class RoutingTable
 {
 public:
+  /// Stable reference to a routing table entry
+  struct Handle
+  {
+    Handle () : m_slot (0xffffffff), m_generation (0) {}
+    uint32_t m_slot;
+    uint32_t m_generation;
+  };
   /// c-tor
   RoutingTable (Time t);
+  ~RoutingTable ();
   ///\name Handle life time of invalid route
   //\{
   Time GetBadLinkLifetime () const { return m_badLinkLifetime; }
@@ -190,10 +238,66 @@ public:
   bool LookupRoute (Ipv4Address dst, RoutingTableEntry & rt);
   /// Lookup route in VALID state
   bool LookupValidRoute (Ipv4Address dst, RoutingTableEntry & rt);
+  /**
+   * Lookup routing table entry with destination address dst, without copying it.
+   * The pointer is valid until the next AddRoute or until the entry is deleted.
+   * \return 0 if there is no such entry
+   */
+  RoutingTableEntry * LookupRoute (Ipv4Address dst);
+  /// Lookup route in VALID state, without copying it. Tries the route cache first
+  RoutingTableEntry * LookupValidRoute (Ipv4Address dst);
+  /**
+   * VALID route to dst within its lifetime, from the route cache only. Does not purge the table.
+   * \return 0 on a cache miss, the caller then looks the route up in the table
+   */
+  RoutingTableEntry * LookupCachedRoute (Ipv4Address dst);
+  /**
+   * Lookup handle of routing table entry with destination address dst
+   * \return true on success
+   */
+  bool LookupHandle (Ipv4Address dst, Handle & handle);
+  /**
+   * Entry referenced by handle. The pointer is valid until the next insertion or deletion.
+   * \return 0 if the entry was deleted
+   */
+  RoutingTableEntry * GetEntry (Handle handle);
+  /// Number of entries
+  uint32_t GetSize () const { return m_index.GetSize (); }
+  ///\name Route cache statistics
+  //\{
+  uint64_t GetCacheHits () const { return m_cacheHits; }
+  uint64_t GetCacheMisses () const { return m_cacheMisses; }
+  //\}
   /// Update routing table
   bool Update (RoutingTableEntry & rt);
+  ///\name In place updates
+  //\{
   /// Set routing table entry flags
   bool SetEntryState (Ipv4Address dst, RouteFlags state);
+  /// Extend lifetime of VALID route to dst to at least lifetime and reset its RREQ count
+  bool UpdateLifeTime (Ipv4Address dst, Time lifetime);
+  /// Same as above for an entry already looked up, does nothing unless rt is a VALID route
+  bool UpdateLifeTime (RoutingTableEntry * rt, Time lifetime);
+  /// Set next hop of route to dst
+  bool SetNextHop (Ipv4Address dst, Ipv4Address nextHop);
+  /// Set output interface of route to dst
+  bool SetInterface (Ipv4Address dst, Ipv4InterfaceAddress iface);
+  /// Set output device and interface of route to dst, the route is shared again only if either changed
+  bool SetOutputDevice (Ipv4Address dst, Ptr<NetDevice> dev, Ipv4InterfaceAddress iface);
+  //\}
+  ///\name RREP_ACK timers, kept outside the entries
+  //\{
+  /**
+   * Keep the scheduled RREP_ACK timeout event of route to dst, cancelling the one it replaces. The
+   * event is cancelled by CancelAckTimer, or when the route is deleted.
+   * \return false, after cancelling event, if there is no route to dst
+   */
+  bool SetAckTimer (Ipv4Address dst, EventId event);
+  /// Cancel and release RREP_ACK timer of route to dst, if any. Also releases a timer that expired
+  void CancelAckTimer (Ipv4Address dst);
+  //\}
+  /// Number of distinct Ipv4Route objects shared by the entries
+  uint32_t GetRouteCount () const { return m_routes.size (); }
   /// Lookup routing entries with next hop Address dst and not empty list of precursors.
   void GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, uint32_t> & unreachable);
   /**
@@ -207,8 +311,8 @@ public:
   /// Delete all route from interface with address iface
   void DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface);
   /// Delete all entries from routing table
-  void Clear () { m_ipv4AddressEntry.clear (); }
-  /// Delete all outdated entries and invalidate valid entry if Lifetime is expired
+  void Clear ();
+  /// Delete all outdated entries and invalidate valid entry if Lifetime is expired. Visits due entries only.
   void Purge ();
   /** Mark entry as unidirectional (e.g. add this neighbor to "blacklist" for blacklistTimeout period)
    * \param neighbor - neighbor address link to which assumed to be unidirectional
@@ -218,13 +322,126 @@ public:
   bool MarkLinkAsUnidirectional (Ipv4Address neighbor, Time blacklistTimeout);
   /// Print routing table
   void Print (Ptr<OutputStreamWrapper> stream) const;
+  /// Append all entries to snapshot record, as Purge () would leave them, in slot order
+  void Snapshot (SnapshotWriter & writer) const;
 
 private:
-  std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;
+  /// Secondary indexes linking slots with the same key
+  enum ListIndex
+  {
+    BY_NEXT_HOP = 0,
+    BY_INTERFACE = 1,
+    LIST_INDEXES = 2
+  };
+  /// Links of a slot in one secondary index
+  struct ListLink
+  {
+    uint32_t m_key;
+    uint32_t m_prev;
+    uint32_t m_next;
+  };
+  /// Entry storage, used or free
+  struct Slot
+  {
+    RoutingTableEntry m_entry;
+    /// Incremented when the slot is released, invalidates handles
+    uint32_t m_generation;
+    /// Incremented when the state, next hop or output device of the route changes, invalidates cache lines
+    uint32_t m_version;
+    bool m_used;
+    /// Deadline of the live expiry record, if m_armed
+    Time m_deadline;
+    bool m_armed;
+    /// Expired IN_SEARCH entry, checked on every purge until its state or lifetime changes
+    bool m_parked;
+    ListLink m_links[LIST_INDEXES];
+  };
+  /// Expiry record, stale once the slot is released or rearmed with another deadline
+  struct Expiry
+  {
+    Time m_time;
+    uint32_t m_slot;
+    uint32_t m_generation;
+    /// Reversed so that std heap functions keep the earliest deadline on top
+    bool operator< (Expiry const & o) const { return m_time > o.m_time; }
+  };
+  /// Last lookup of a destination
+  struct CacheLine
+  {
+    CacheLine () : m_dst (0), m_slot (0xffffffff), m_generation (0), m_version (0) {}
+    uint32_t m_dst;
+    uint32_t m_slot;
+    uint32_t m_generation;
+    uint32_t m_version;
+  };
+  /// Route cache size is 1 << CACHE_BITS lines
+  static const uint32_t CACHE_BITS = 6;
+  /// Key of a shared Ipv4Route
+  struct RouteKey
+  {
+    RouteKey (Ipv4Route const & r) :
+      m_gateway (r.GetGateway ().Get ()), m_source (r.GetSource ().Get ()), m_device (PeekPointer (r.GetOutputDevice ())) {}
+    uint32_t m_gateway;
+    uint32_t m_source;
+    NetDevice * m_device;
+    bool operator< (RouteKey const & o) const
+    {
+      if (m_gateway != o.m_gateway)
+        return m_gateway < o.m_gateway;
+      if (m_source != o.m_source)
+        return m_source < o.m_source;
+      return m_device < o.m_device;
+    }
+  };
+  RoutingTable (RoutingTable const &);
+  RoutingTable & operator= (RoutingTable const &);
+  /// Slot of destination dst, 0xffffffff if there is no route
+  uint32_t FindSlot (Ipv4Address dst) const;
+  /// Route cache line of destination dst
+  CacheLine & GetCacheLine (Ipv4Address dst) { return m_cache[(dst.Get () * 2654435761u) >> (32 - CACHE_BITS)]; }
+  /// Release slot and remove it from the index
+  void EraseSlot (uint32_t slot);
+  /// Record current lifetime of the entry in slot as its deadline
+  void Arm (uint32_t slot);
+  /// Whether expiry record e is the live record of its slot
+  bool IsLive (Expiry const & e) const;
+  /// Drop stale expiry records
+  void CompactExpiries ();
+  /// Key of the entry in slot in secondary index
+  uint32_t GetListKey (uint32_t slot, ListIndex index) const;
+  /// Insert slot at the head of its list in index
+  void Link (uint32_t slot, ListIndex index);
+  /// Remove slot from its list in index
+  void Unlink (uint32_t slot, ListIndex index);
+  /// Move slot to the lists matching its entry's current next hop and interface
+  void Relink (uint32_t slot);
+  /// Replace the route of entry in slot with the shared route with the same key
+  void Intern (uint32_t slot);
+  /// Release shared routes no entry uses any more
+  void SweepRoutes ();
+  std::vector<Slot> m_slots;
+  /// Released slots
+  std::vector<uint32_t> m_freeSlots;
+  /// Destination address -> slot
+  FlatHashMap<uint32_t> m_index;
+  /// Next hop or interface address -> first slot of its list
+  FlatHashMap<uint32_t> m_listHeads[LIST_INDEXES];
+  /// Expiry records, earliest deadline first
+  std::vector<Expiry> m_expiries;
+  /// Expired IN_SEARCH entries
+  std::vector<Handle> m_parked;
+  /// Shared routes
+  std::map<RouteKey, Ptr<Ipv4Route> > m_routes;
+  /// Number of shared routes left by the last sweep
+  uint32_t m_routesSwept;
+  /// Destination address -> RREP_ACK timer
+  FlatHashMap<EventId> m_ackTimers;
+  /// Route cache
+  CacheLine m_cache[1 << CACHE_BITS];
+  uint64_t m_cacheHits;
+  uint64_t m_cacheMisses;
   /// Deletion time for invalid routes
   Time m_badLinkLifetime;
-  /// const version of Purge, for use by Print() method
-  void Purge (std::map<Ipv4Address, RoutingTableEntry> &table) const;
 };
 
 }
@@ -0,0 +1,111 @@
+#include "aodv-seq-window.h"
+#include "ns3/test.h"
+#include <vector>
+
+namespace ns3
+{
+namespace aodvmesh
+{
+bool
+SequenceWindowCache::IsDuplicate (Ipv4Address addr, uint16_t seqNo)
+{
+  // Stale windows are dropped once per lifetime, i.e. O(1) amortized per call
+  if (Simulator::Now () - m_lastPurge >= m_lifetime)
+    Purge ();
+  bool inserted;
+  Window * w = m_windows.Insert (addr.Get (), Window (), &inserted);
+  Time expire = m_lifetime + Simulator::Now ();
+  if (inserted || w->m_expire < Simulator::Now ())
+    {
+      w->m_highest = seqNo;
+      w->m_bitmap = 1;
+      w->m_expire = expire;
+      return false;
+    }
+  int32_t diff = int16_t (uint16_t (seqNo - w->m_highest));
+  if (diff > 0)
+    {
+      w->m_bitmap = (diff < WINDOW_SIZE) ? ((w->m_bitmap << diff) | 1) : 1;
+      w->m_highest = seqNo;
+      w->m_expire = expire;
+      return false;
+    }
+  if (-diff >= WINDOW_SIZE)
+    return true;
+  uint64_t bit = uint64_t (1) << -diff;
+  if (w->m_bitmap & bit)
+    return true;
+  w->m_bitmap |= bit;
+  w->m_expire = expire;
+  return false;
+}
+
+void
+SequenceWindowCache::Purge ()
+{
+  m_lastPurge = Simulator::Now ();
+  std::vector<uint64_t> stale;
+  for (uint32_t i = 0; i < m_windows.GetCapacity (); ++i)
+    if (m_windows.IsUsed (i) && m_windows.GetValue (i).m_expire < Simulator::Now ())
+      stale.push_back (m_windows.GetKey (i));
+  for (std::vector<uint64_t>::const_iterator i = stale.begin (); i != stale.end (); ++i)
+    m_windows.Erase (*i);
+}
+
+uint32_t
+SequenceWindowCache::GetSize ()
+{
+  Purge ();
+  return m_windows.GetSize ();
+}
+
+//-----------------------------------------------------------------------------
+// Tests
+//-----------------------------------------------------------------------------
+/// Unit test for sequence window cache
+struct SequenceWindowCacheTest : public TestCase
+{
+  SequenceWindowCacheTest () : TestCase ("Sequence window cache"), cache (Seconds (2))
+  {}
+  virtual void DoRun ();
+  void CheckTimeout ();
+
+  SequenceWindowCache cache;
+};
+
+void
+SequenceWindowCacheTest::DoRun ()
+{
+  Ipv4Address a ("1.2.3.4");
+  Ipv4Address b ("4.3.2.1");
+  Ipv4Address c ("5.6.7.8");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 100), false, "Unknown originator");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 100), true, "Known sequence number");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (b, 100), false, "Other originator");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 102), false, "Newer");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 101), false, "Reordered within window");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 101), true, "Reordered duplicate");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (a, 102 - 64), true, "Older than window");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 65535), false, "Before wraparound");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 1), false, "Wraparound");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 0), false, "Reordered across wraparound");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 65535), true, "Duplicate across wraparound");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 1000), false, "Jump beyond window");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (c, 1), true, "Old after jump");
+  NS_TEST_EXPECT_MSG_EQ (cache.GetSize (), 3, "trivial");
+
+  Simulator::Schedule (Seconds (3), &SequenceWindowCacheTest::CheckTimeout, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+SequenceWindowCacheTest::CheckTimeout ()
+{
+  NS_TEST_EXPECT_MSG_EQ (cache.GetSize (), 0, "All windows expire");
+  NS_TEST_EXPECT_MSG_EQ (cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 1), false, "Fresh window after silence");
+}
+//-----------------------------------------------------------------------------
+
+}
+}
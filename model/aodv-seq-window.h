@@ -0,0 +1,62 @@
+#ifndef __AODV_SEQ_WINDOW_H__
+#define __AODV_SEQ_WINDOW_H__
+
+#include "ns3/ipv4-address.h"
+#include "ns3/simulator.h"
+#include "aodv-flat-hash.h"
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/**
+ * \ingroup aodv
+ *
+ * \brief Exact duplicate detection for monotonically increasing 16 bit sequence numbers.
+ *
+ * Keeps per originator the highest sequence number seen and a 64 bit bitmap of the
+ * sequence numbers just below it (IPsec anti-replay window). Sequence numbers are compared
+ * in serial number arithmetic, so wraparound of the 16 bit counter is handled. Numbers
+ * older than the window are reported as duplicates. An originator not heard for lifetime
+ * starts a fresh window.
+ */
+class SequenceWindowCache
+{
+public:
+  /// c-tor
+  SequenceWindowCache (Time lifetime) : m_lifetime (lifetime), m_lastPurge (Simulator::Now ()) {}
+  /// Check that seqNo from addr was already seen. Record it, if it wasn't.
+  bool IsDuplicate (Ipv4Address addr, uint16_t seqNo);
+  /// Remove originators not heard for lifetime
+  void Purge ();
+  /// Return number of tracked originators
+  uint32_t GetSize ();
+  /// Set lifetime of originator windows
+  void SetLifetime (Time lifetime) { m_lifetime = lifetime; }
+  /// Return lifetime of originator windows
+  Time GetLifeTime () const { return m_lifetime; }
+private:
+  /// Number of sequence numbers tracked below the highest one
+  static const int32_t WINDOW_SIZE = 64;
+  /// Sliding window of one originator
+  struct Window
+  {
+    Window () : m_highest (0), m_bitmap (0) {}
+    /// Highest sequence number seen
+    uint16_t m_highest;
+    /// Bit i set if m_highest - i was seen
+    uint64_t m_bitmap;
+    /// When window will expire
+    Time m_expire;
+  };
+  /// Windows by originator address
+  FlatHashMap<Window> m_windows;
+  /// Lifetime of windows
+  Time m_lifetime;
+  /// Last time stale windows were removed
+  Time m_lastPurge;
+};
+
+}
+}
+#endif /* __AODV_SEQ_WINDOW_H__ */
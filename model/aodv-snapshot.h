@@ -0,0 +1,250 @@
+#ifndef __AODV_SNAPSHOT_H__
+#define __AODV_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <vector>
+#include <istream>
+
+namespace ns3
+{
+namespace aodvmesh
+{
+/**
+ * \ingroup aodv
+ *
+ * \brief Binary snapshot format of routing table and neighbor table state.
+ *
+ * A snapshot stream is a sequence of node records. Each record is a header followed by
+ * the route and neighbor entries of one node at one instant:
+ *
+ *   header   32 bytes: magic, version, header size, node id, main address, time (ns),
+ *                      route count, neighbor count
+ *   route    32 bytes: destination, next hop, interface address, sequence number,
+ *                      remaining lifetime (ns), hops, flag, bits, precursor count
+ *   neighbor 28 bytes: address, weight, associated core, remaining expire time (ns),
+ *                      hello counter, 2-hop BN neighbor count, status, indicator, bits
+ *
+ * All fields are little endian. Addresses are host order Ipv4Address::Get () values.
+ * This header only depends on the standard library, so offline tools can include it.
+ */
+struct SnapshotRoute
+{
+  /// Route bits
+  enum
+  {
+    VALID_SEQNO = 1,
+    UNIDIRECTIONAL = 2
+  };
+  uint32_t m_dst;
+  uint32_t m_nextHop;
+  uint32_t m_interface;
+  uint32_t m_seqNo;
+  int64_t m_lifeTime;
+  uint16_t m_hops;
+  uint8_t m_flag;
+  uint8_t m_bits;
+  uint16_t m_precursors;
+};
+
+/// Neighbor entry of a snapshot
+struct SnapshotNeighbor
+{
+  /// Neighbor bits
+  enum
+  {
+    CLOSE = 1,
+    CLIENT = 2,
+    HARDWARE_ADDRESS = 4
+  };
+  uint32_t m_address;
+  uint32_t m_weight;
+  uint32_t m_associatedCore;
+  int64_t m_expireTime;
+  uint16_t m_helloCounter;
+  uint16_t m_bnNeighbors;
+  uint8_t m_status;
+  uint8_t m_indicator;
+  uint8_t m_bits;
+};
+
+/// Node record of a snapshot, as decoded by SnapshotReader
+struct Snapshot
+{
+  uint32_t m_node;
+  uint32_t m_address;
+  int64_t m_time;
+  std::vector<SnapshotRoute> m_routes;
+  std::vector<SnapshotNeighbor> m_neighbors;
+};
+
+/// Snapshot format constants
+struct SnapshotFormat
+{
+  static const uint32_t MAGIC = 0x53534d41;
+  static const uint16_t VERSION = 1;
+  static const uint16_t HEADER_SIZE = 32;
+  static const uint32_t ROUTE_SIZE = 32;
+  static const uint32_t NEIGHBOR_SIZE = 28;
+};
+
+/**
+ * \brief Encodes one node record into a contiguous buffer.
+ *
+ * The buffer is kept between records, so steady state snapshots do not allocate.
+ */
+class SnapshotWriter
+{
+public:
+  /// c-tor
+  SnapshotWriter () : m_routes (0), m_neighbors (0) {}
+  /// Start the record of node with main address at time (ns)
+  void Begin (uint32_t node, uint32_t address, int64_t time)
+  {
+    m_buffer.clear ();
+    m_routes = 0;
+    m_neighbors = 0;
+    WriteU32 (SnapshotFormat::MAGIC);
+    WriteU16 (SnapshotFormat::VERSION);
+    WriteU16 (SnapshotFormat::HEADER_SIZE);
+    WriteU32 (node);
+    WriteU32 (address);
+    WriteU64 (time);
+    WriteU32 (0);
+    WriteU32 (0);
+  }
+  /// Append a route, routes must be added before neighbors
+  void AddRoute (SnapshotRoute const & r)
+  {
+    WriteU32 (r.m_dst);
+    WriteU32 (r.m_nextHop);
+    WriteU32 (r.m_interface);
+    WriteU32 (r.m_seqNo);
+    WriteU64 (r.m_lifeTime);
+    WriteU16 (r.m_hops);
+    WriteU8 (r.m_flag);
+    WriteU8 (r.m_bits);
+    WriteU16 (r.m_precursors);
+    WriteU16 (0);
+    m_routes++;
+  }
+  /// Append a neighbor
+  void AddNeighbor (SnapshotNeighbor const & n)
+  {
+    WriteU32 (n.m_address);
+    WriteU32 (n.m_weight);
+    WriteU32 (n.m_associatedCore);
+    WriteU64 (n.m_expireTime);
+    WriteU16 (n.m_helloCounter);
+    WriteU16 (n.m_bnNeighbors);
+    WriteU8 (n.m_status);
+    WriteU8 (n.m_indicator);
+    WriteU8 (n.m_bits);
+    WriteU8 (0);
+    m_neighbors++;
+  }
+  /// Complete the header. \return the record, valid until the next Begin ()
+  char const * Finish ()
+  {
+    Patch (24, m_routes);
+    Patch (28, m_neighbors);
+    return reinterpret_cast<char const *> (&m_buffer[0]);
+  }
+  /// Size of the record in bytes
+  uint32_t GetSize () const { return m_buffer.size (); }
+private:
+  void WriteU8 (uint8_t v) { m_buffer.push_back (v); }
+  void WriteU16 (uint16_t v) { WriteU8 (v & 0xff); WriteU8 (v >> 8); }
+  void WriteU32 (uint32_t v) { WriteU16 (v & 0xffff); WriteU16 (v >> 16); }
+  void WriteU64 (uint64_t v) { WriteU32 (v & 0xffffffff); WriteU32 (v >> 32); }
+  void Patch (uint32_t offset, uint32_t v)
+  {
+    for (uint32_t i = 0; i < 4; ++i)
+      m_buffer[offset + i] = (v >> (8 * i)) & 0xff;
+  }
+  std::vector<uint8_t> m_buffer;
+  uint32_t m_routes;
+  uint32_t m_neighbors;
+};
+
+/// Decodes node records written by SnapshotWriter
+class SnapshotReader
+{
+public:
+  /// Input status
+  enum Status
+  {
+    OK,
+    END,
+    CORRUPT
+  };
+  /// c-tor
+  SnapshotReader (std::istream & is) : m_is (is) {}
+  /// Read the next node record into s
+  Status Next (Snapshot & s)
+  {
+    uint8_t header[SnapshotFormat::HEADER_SIZE];
+    if (!Read (header, 4))
+      return END;
+    if (!Read (header + 4, SnapshotFormat::HEADER_SIZE - 4) || GetU32 (header) != SnapshotFormat::MAGIC
+        || GetU16 (header + 4) != SnapshotFormat::VERSION)
+      return CORRUPT;
+    // Later versions may grow the header
+    for (uint32_t skip = GetU16 (header + 6); skip > SnapshotFormat::HEADER_SIZE; --skip)
+      if (m_is.get () == std::istream::traits_type::eof ())
+        return CORRUPT;
+    s.m_node = GetU32 (header + 8);
+    s.m_address = GetU32 (header + 12);
+    s.m_time = GetU64 (header + 16);
+    uint32_t routes = GetU32 (header + 24);
+    uint32_t neighbors = GetU32 (header + 28);
+    s.m_routes.resize (routes);
+    s.m_neighbors.resize (neighbors);
+    uint8_t b[SnapshotFormat::ROUTE_SIZE];
+    for (uint32_t i = 0; i < routes; ++i)
+      {
+        if (!Read (b, SnapshotFormat::ROUTE_SIZE))
+          return CORRUPT;
+        SnapshotRoute & r = s.m_routes[i];
+        r.m_dst = GetU32 (b);
+        r.m_nextHop = GetU32 (b + 4);
+        r.m_interface = GetU32 (b + 8);
+        r.m_seqNo = GetU32 (b + 12);
+        r.m_lifeTime = GetU64 (b + 16);
+        r.m_hops = GetU16 (b + 24);
+        r.m_flag = b[26];
+        r.m_bits = b[27];
+        r.m_precursors = GetU16 (b + 28);
+      }
+    for (uint32_t i = 0; i < neighbors; ++i)
+      {
+        if (!Read (b, SnapshotFormat::NEIGHBOR_SIZE))
+          return CORRUPT;
+        SnapshotNeighbor & n = s.m_neighbors[i];
+        n.m_address = GetU32 (b);
+        n.m_weight = GetU32 (b + 4);
+        n.m_associatedCore = GetU32 (b + 8);
+        n.m_expireTime = GetU64 (b + 12);
+        n.m_helloCounter = GetU16 (b + 20);
+        n.m_bnNeighbors = GetU16 (b + 22);
+        n.m_status = b[24];
+        n.m_indicator = b[25];
+        n.m_bits = b[26];
+      }
+    return OK;
+  }
+private:
+  bool Read (uint8_t * b, uint32_t n)
+  {
+    m_is.read (reinterpret_cast<char *> (b), n);
+    return uint32_t (m_is.gcount ()) == n;
+  }
+  static uint16_t GetU16 (uint8_t const * b) { return b[0] | (b[1] << 8); }
+  static uint32_t GetU32 (uint8_t const * b) { return GetU16 (b) | (uint32_t (GetU16 (b + 2)) << 16); }
+  static uint64_t GetU64 (uint8_t const * b) { return GetU32 (b) | (uint64_t (GetU32 (b + 4)) << 32); }
+  std::istream & m_is;
+};
+
+}
+}
+
+#endif /* __AODV_SNAPSHOT_H__ */
@@ -0,0 +1,164 @@
+/*
+ * Route setup latency and ARP traffic with and without the LearnArpFromControl option of
+ * aodvmesh::RoutingProtocol. Build it as an ns-3 program next to the module, e.g. from scratch/:
+ *
+ *   cp utils/aodv-arp-learning.cc <ns-3>/scratch/ && ./waf --run "aodv-arp-learning --learnArp=0"
+ *   ./waf --run "aodv-arp-learning --learnArp=1"
+ *
+ * Usage: aodv-arp-learning [--nodes=N] [--spacing=M] [--learnArp=0|1] [--run=R]
+ *
+ * N nodes stand on a line, M meters apart, and only neighbors on the line hear each other. After
+ * the hellos settle, node 0 sends a single UDP packet to every other node in turn, each one
+ * starting a new route discovery. Prints one line per destination (hops, delay of the packet from
+ * the send call to its delivery, which includes route discovery and address resolution at every
+ * hop) followed by a summary line with the mean setup delay and the number of ARP frames sent.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/wifi-module.h"
+#include "ns3/ipv4-routing-helper.h"
+#include "ns3/llc-snap-header.h"
+#include <cstdio>
+#include <vector>
+
+using namespace ns3;
+
+/// Installs aodvmesh::RoutingProtocol through InternetStackHelper
+class AodvMeshHelper : public Ipv4RoutingHelper
+{
+public:
+  AodvMeshHelper ()
+  {
+    m_agentFactory.SetTypeId ("ns3::aodvmesh::RoutingProtocol");
+  }
+  AodvMeshHelper * Copy () const
+  {
+    return new AodvMeshHelper (*this);
+  }
+  Ptr<Ipv4RoutingProtocol> Create (Ptr<Node> node) const
+  {
+    Ptr<Ipv4RoutingProtocol> agent = m_agentFactory.Create<Ipv4RoutingProtocol> ();
+    node->AggregateObject (agent);
+    return agent;
+  }
+  void Set (std::string name, AttributeValue const & value)
+  {
+    m_agentFactory.Set (name, value);
+  }
+private:
+  ObjectFactory m_agentFactory;
+};
+
+static const uint16_t PORT = 9;
+static uint32_t g_arpFrames = 0;
+static std::vector<Time> g_sent;
+static std::vector<Time> g_delivered;
+
+static void
+MacTx (Ptr<Packet const> packet)
+{
+  LlcSnapHeader llc;
+  if (packet->PeekHeader (llc) && llc.GetType () == ArpL3Protocol::PROT_NUMBER)
+    g_arpFrames++;
+}
+
+static void
+Receive (uint32_t node, Ptr<Socket> socket)
+{
+  while (socket->Recv ())
+    if (g_delivered[node].IsZero ())
+      g_delivered[node] = Simulator::Now ();
+}
+
+static void
+Send (Ptr<Socket> socket, Ipv4Address dst, uint32_t node)
+{
+  g_sent[node] = Simulator::Now ();
+  socket->SendTo (Create<Packet> (64), 0, InetSocketAddress (dst, PORT));
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint32_t nodes = 6;
+  double spacing = 100;
+  bool learnArp = false;
+  uint32_t run = 1;
+  CommandLine cmd;
+  cmd.AddValue ("nodes", "Number of nodes on the line", nodes);
+  cmd.AddValue ("spacing", "Distance between neighbors on the line (m)", spacing);
+  cmd.AddValue ("learnArp", "Value of ns3::aodvmesh::RoutingProtocol::LearnArpFromControl", learnArp);
+  cmd.AddValue ("run", "Run number of the random number generator", run);
+  cmd.Parse (argc, argv);
+  RngSeedManager::SetRun (run);
+
+  NodeContainer n;
+  n.Create (nodes);
+  MobilityHelper mobility;
+  mobility.SetPositionAllocator ("ns3::GridPositionAllocator", "DeltaX", DoubleValue (spacing),
+                                 "GridWidth", UintegerValue (nodes), "LayoutType", StringValue ("RowFirst"));
+  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+  mobility.Install (n);
+
+  WifiHelper wifi;
+  wifi.SetStandard (WIFI_PHY_STANDARD_80211b);
+  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager", "DataMode", StringValue ("DsssRate1Mbps"),
+                                "ControlMode", StringValue ("DsssRate1Mbps"));
+  YansWifiChannelHelper wifiChannel;
+  wifiChannel.SetPropagationDelay ("ns3::ConstantSpeedPropagationDelayModel");
+  wifiChannel.AddPropagationLoss ("ns3::RangePropagationLossModel", "MaxRange", DoubleValue (spacing * 1.5));
+  YansWifiPhyHelper wifiPhy = YansWifiPhyHelper::Default ();
+  wifiPhy.SetChannel (wifiChannel.Create ());
+  NqosWifiMacHelper wifiMac = NqosWifiMacHelper::Default ();
+  wifiMac.SetType ("ns3::AdhocWifiMac");
+  NetDeviceContainer devices = wifi.Install (wifiPhy, wifiMac, n);
+
+  AodvMeshHelper aodv;
+  aodv.Set ("LearnArpFromControl", BooleanValue (learnArp));
+  InternetStackHelper stack;
+  stack.SetRoutingHelper (aodv);
+  stack.Install (n);
+  Ipv4AddressHelper ipv4;
+  ipv4.SetBase ("10.0.0.0", "255.255.255.0");
+  Ipv4InterfaceContainer interfaces = ipv4.Assign (devices);
+
+  g_sent.assign (nodes, Seconds (0));
+  g_delivered.assign (nodes, Seconds (0));
+  TypeId udp = TypeId::LookupByName ("ns3::UdpSocketFactory");
+  Ptr<Socket> source = Socket::CreateSocket (n.Get (0), udp);
+  source->Bind ();
+  for (uint32_t i = 1; i < nodes; ++i)
+    {
+      Ptr<Socket> sink = Socket::CreateSocket (n.Get (i), udp);
+      sink->Bind (InetSocketAddress (Ipv4Address::GetAny (), PORT));
+      sink->SetRecvCallback (MakeBoundCallback (&Receive, i));
+      // Hellos have run for 10 s; the discoveries are spaced so they do not overlap
+      Simulator::Schedule (Seconds (10 + 2 * i), &Send, source, interfaces.GetAddress (i), i);
+    }
+  Config::ConnectWithoutContext ("/NodeList/*/DeviceList/*/$ns3::WifiNetDevice/Mac/MacTx", MakeCallback (&MacTx));
+
+  Simulator::Stop (Seconds (10 + 2 * nodes + 5));
+  Simulator::Run ();
+
+  double total = 0;
+  uint32_t delivered = 0;
+  for (uint32_t i = 1; i < nodes; ++i)
+    {
+      if (g_delivered[i].IsZero ())
+        {
+          printf ("dst %u hops %u lost\n", i, i);
+          continue;
+        }
+      double ms = (g_delivered[i] - g_sent[i]).GetSeconds () * 1000;
+      printf ("dst %u hops %u setup_ms %.3f\n", i, i, ms);
+      total += ms;
+      delivered++;
+    }
+  printf ("learnArp %d nodes %u delivered %u/%u mean_setup_ms %.3f arp_frames %u\n", learnArp, nodes,
+          delivered, nodes - 1, delivered ? total / delivered : 0.0, g_arpFrames);
+  Simulator::Destroy ();
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Cost of the per packet Neighbors operations at 20, 100 and 300 neighbors. Build against an
+ * optimized ns-3 build:
+ *
+ *   g++ -O2 -I model -I <ns-3>/build -o aodv-neighbor-bench utils/aodv-neighbor-bench.cc \
+ *       model/aodv-neighbor.cc model/aodv-packet.cc -L <ns-3>/build -lns3.25-core-optimized \
+ *       -lns3.25-network-optimized -lns3.25-internet-optimized -lns3.25-wifi-optimized
+ *
+ * Usage: aodv-neighbor-bench
+ *
+ *   find        FindNeighborTuple of a random neighbor
+ *   touch       Touch of a random neighbor with resolved hardware address, as on forwarding
+ *   isneighbor  IsNeighbor of a random neighbor, including the Purge it runs first
+ *   reinsert    InsertNeighborTuple of a random neighbor already in the table
+ */
+
+#include "aodv-neighbor.h"
+#include "ns3/arp-cache.h"
+#include "ns3/mac48-address.h"
+#include "ns3/packet.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+using namespace ns3;
+using namespace ns3::aodvmesh;
+
+static const uint32_t CALLS = 2000000;
+/// Keeps the results of the lookups alive
+static uint64_t g_sink;
+
+/// ns per call of the elapsed time since start
+static double
+Elapsed (clock_t start, uint32_t calls)
+{
+  return double (clock () - start) * 1e9 / CLOCKS_PER_SEC / calls;
+}
+
+static void
+Run (uint32_t neighbors)
+{
+  Ptr<ArpCache> arp = CreateObject<ArpCache> ();
+  Neighbors nb (Seconds (1));
+  nb.AddArpCache (arp);
+  for (uint32_t i = 0; i < neighbors; ++i)
+    {
+      Ipv4Address addr (0x0a000000 + i);
+      ArpCache::Entry * entry = arp->Add (addr);
+      entry->MarkWaitReply (ArpCache::Ipv4PayloadHeaderPair (Create<Packet> (), Ipv4Header ()));
+      entry->MarkAlive (Mac48Address::Allocate ());
+      NeighborTuple tuple (addr, Simulator::Now () + Seconds (1000));
+      tuple.neighborWeight = i % 7;
+      nb.InsertNeighborTuple (tuple);
+      // Resolves the hardware address of the neighbor
+      nb.Update (addr, Seconds (1000));
+    }
+  // Random picks drawn up front, so the loops time the table only
+  std::vector<Ipv4Address> picks (1 << 16);
+  srand (1);
+  for (uint32_t i = 0; i < picks.size (); ++i)
+    picks[i] = Ipv4Address (0x0a000000 + rand () % neighbors);
+  uint32_t mask = picks.size () - 1;
+
+  clock_t start = clock ();
+  for (uint32_t i = 0; i < CALLS; ++i)
+    g_sink += nb.FindNeighborTuple (picks[i & mask])->neighborWeight;
+  double find = Elapsed (start, CALLS);
+
+  start = clock ();
+  for (uint32_t i = 0; i < CALLS; ++i)
+    nb.Touch (picks[i & mask], Seconds (1000));
+  double touch = Elapsed (start, CALLS);
+
+  start = clock ();
+  for (uint32_t i = 0; i < CALLS / 10; ++i)
+    g_sink += nb.IsNeighbor (picks[i & mask]);
+  double isNeighbor = Elapsed (start, CALLS / 10);
+
+  start = clock ();
+  for (uint32_t i = 0; i < CALLS / 10; ++i)
+    nb.InsertNeighborTuple (NeighborTuple (picks[i & mask], Simulator::Now () + Seconds (1000)));
+  double reinsert = Elapsed (start, CALLS / 10);
+
+  printf ("%4u neighbors: find %6.1f ns   touch %6.1f ns   isneighbor %8.1f ns   reinsert %8.1f ns\n",
+          neighbors, find, touch, isNeighbor, reinsert);
+  nb.Clear ();
+  Simulator::Destroy ();
+}
+
+int
+main ()
+{
+  uint32_t neighbors[] = { 20, 100, 300 };
+  for (uint32_t k = 0; k < sizeof (neighbors) / sizeof (neighbors[0]); ++k)
+    Run (neighbors[k]);
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Cost per RequestQueue operation with 64 destinations and MaxQueueLen 4096, against the
+ * single vector queue RequestQueue replaced. Build against an optimized ns-3 build:
+ *
+ *   g++ -O2 -I model -I <ns-3>/build -o aodv-rqueue-bench utils/aodv-rqueue-bench.cc \
+ *       model/aodv-rqueue.cc -L <ns-3>/build -lns3.25-core-optimized \
+ *       -lns3.25-network-optimized -lns3.25-internet-optimized
+ *
+ * Usage: aodv-rqueue-bench
+ *
+ * The queue is kept full by a mix of 5/8 Enqueue, 2/8 Dequeue, Find and a rare
+ * DropPacketWithDst. Both queues see the same operations; the checksum over enqueue results,
+ * dequeued packets and drops must match.
+ */
+
+#include "aodv-rqueue.h"
+#include "ns3/packet.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+using namespace ns3;
+using namespace ns3::aodvmesh;
+
+/// The previous RequestQueue: one vector, purged and scanned by every operation
+class VectorRequestQueue
+{
+public:
+  VectorRequestQueue (uint32_t maxLen, Time routeToQueueTimeout) : m_maxLen (maxLen), m_queueTimeout (routeToQueueTimeout) {}
+  bool Enqueue (QueueEntry & entry)
+  {
+    Purge ();
+    for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+      if (i->GetPacket ()->GetUid () == entry.GetPacket ()->GetUid ()
+          && i->GetIpv4Header ().GetDestination () == entry.GetIpv4Header ().GetDestination ())
+        return false;
+    entry.SetExpireTime (m_queueTimeout);
+    if (m_queue.size () == m_maxLen)
+      {
+        Drop (m_queue.front ());
+        m_queue.erase (m_queue.begin ());
+      }
+    m_queue.push_back (entry);
+    return true;
+  }
+  bool Dequeue (Ipv4Address dst, QueueEntry & entry)
+  {
+    Purge ();
+    for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+      if (i->GetIpv4Header ().GetDestination () == dst)
+        {
+          entry = *i;
+          m_queue.erase (i);
+          return true;
+        }
+    return false;
+  }
+  void DropPacketWithDst (Ipv4Address dst)
+  {
+    Purge ();
+    std::vector<QueueEntry>::iterator last = m_queue.begin ();
+    for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+      if (i->GetIpv4Header ().GetDestination () == dst)
+        Drop (*i);
+      else
+        *last++ = *i;
+    m_queue.erase (last, m_queue.end ());
+  }
+  bool Find (Ipv4Address dst)
+  {
+    for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+      if (i->GetIpv4Header ().GetDestination () == dst)
+        return true;
+    return false;
+  }
+  uint32_t GetSize ()
+  {
+    Purge ();
+    return m_queue.size ();
+  }
+private:
+  void Purge ()
+  {
+    std::vector<QueueEntry>::iterator last = m_queue.begin ();
+    for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+      if (i->GetExpireTime () < Seconds (0))
+        Drop (*i);
+      else
+        *last++ = *i;
+    m_queue.erase (last, m_queue.end ());
+  }
+  void Drop (QueueEntry const & entry)
+  {
+    entry.GetErrorCallback () (entry.GetPacket (), entry.GetIpv4Header (), Socket::ERROR_NOROUTETOHOST);
+  }
+  std::vector<QueueEntry> m_queue;
+  uint32_t m_maxLen;
+  Time m_queueTimeout;
+};
+
+static const uint32_t DESTINATIONS = 64;
+static const uint32_t MAX_QUEUE_LEN = 4096;
+static const uint32_t OPERATIONS = 400000;
+
+static uint64_t g_drops;
+
+static void
+CountDrop (Ptr<const Packet> packet, Ipv4Header const & header, Socket::SocketErrno err)
+{
+  g_drops++;
+}
+
+/// \return ns per queue operation, checksum of the observable results
+template <class Queue>
+static double
+Run (std::vector<Ptr<Packet> > const & packets, uint64_t & checksum)
+{
+  // MaxQueueTime of the routing protocol, nothing expires during the run
+  Queue queue (MAX_QUEUE_LEN, Seconds (30));
+  srand (1);
+  g_drops = 0;
+  checksum = 0;
+  clock_t start = clock ();
+  for (uint32_t i = 0; i < OPERATIONS; ++i)
+    {
+      uint32_t r = rand ();
+      Ipv4Address dst (0x0a000000 + (r >> 8) % DESTINATIONS);
+      if (r % 8 < 5)
+        {
+          Ipv4Header header;
+          header.SetDestination (Ipv4Address (0x0a000000 + r % DESTINATIONS));
+          QueueEntry entry (packets[i % packets.size ()], header, QueueEntry::UnicastForwardCallback (),
+                            MakeCallback (&CountDrop));
+          checksum += queue.Enqueue (entry);
+        }
+      else if (r % 8 < 7)
+        {
+          QueueEntry entry;
+          if (queue.Dequeue (dst, entry))
+            checksum += entry.GetPacket ()->GetUid ();
+        }
+      else if (r % 1024 == 7)
+        queue.DropPacketWithDst (dst);
+      else
+        checksum += queue.Find (dst);
+    }
+  double ns = double (clock () - start) * 1e9 / CLOCKS_PER_SEC / OPERATIONS;
+  checksum += queue.GetSize () + g_drops * 1000003;
+  return ns;
+}
+
+int
+main ()
+{
+  // Reused round robin, long after the previous use of a packet has left the queue
+  std::vector<Ptr<Packet> > packets;
+  for (uint32_t i = 0; i < 65536; ++i)
+    packets.push_back (Create<Packet> (64));
+  uint64_t vectorSum, indexedSum;
+  double vectorNs = Run<VectorRequestQueue> (packets, vectorSum);
+  double indexedNs = Run<RequestQueue> (packets, indexedSum);
+  printf ("%u destinations, MaxQueueLen %u: vector %.1f ns/op   indexed %.1f ns/op   checksum %s\n",
+          DESTINATIONS, MAX_QUEUE_LEN, vectorNs, indexedNs, vectorSum == indexedSum ? "match" : "MISMATCH");
+  Simulator::Destroy ();
+  return 0;
+}
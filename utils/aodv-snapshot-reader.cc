@@ -0,0 +1,161 @@
+/*
+ * Offline reader for binary routing table and neighbor snapshots written by
+ * aodvmesh::RoutingProtocol::WriteSnapshot. Depends on the standard library only:
+ *
+ *   g++ -O2 -I model -o aodv-snapshot-reader utils/aodv-snapshot-reader.cc
+ *
+ * Usage: aodv-snapshot-reader [summary|routes|neighbors] snapshot-file
+ *
+ *   summary    per snapshot time: nodes, routes by state, routes and neighbors per node
+ *   routes     one CSV line per route
+ *   neighbors  one CSV line per neighbor
+ */
+
+#include "aodv-snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace ns3::aodvmesh;
+
+static std::string
+Address (uint32_t a)
+{
+  char s[16];
+  sprintf (s, "%u.%u.%u.%u", a >> 24, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+  return s;
+}
+
+static const char *
+Flag (uint8_t flag)
+{
+  switch (flag)
+    {
+    case 0:
+      return "UP";
+    case 1:
+      return "DOWN";
+    case 2:
+      return "IN_SEARCH";
+    }
+  return "?";
+}
+
+static const char *
+Status (uint8_t status)
+{
+  switch (status)
+    {
+    case 1:
+      return "RN";
+    case 2:
+      return "BCN";
+    case 3:
+      return "BN";
+    }
+  return "?";
+}
+
+/// Totals over the node records of one snapshot time
+struct Summary
+{
+  Summary () : m_time (0), m_nodes (0), m_maxRoutes (0), m_neighbors (0)
+  {
+    memset (m_routes, 0, sizeof (m_routes));
+  }
+  void Add (Snapshot const & s)
+  {
+    m_time = s.m_time;
+    m_nodes++;
+    for (std::vector<SnapshotRoute>::const_iterator i = s.m_routes.begin (); i != s.m_routes.end (); ++i)
+      m_routes[i->m_flag < 3 ? i->m_flag : 3]++;
+    if (s.m_routes.size () > m_maxRoutes)
+      m_maxRoutes = s.m_routes.size ();
+    m_neighbors += s.m_neighbors.size ();
+  }
+  void Print () const
+  {
+    uint64_t routes = m_routes[0] + m_routes[1] + m_routes[2] + m_routes[3];
+    printf ("%.3f,%u,%llu,%llu,%llu,%.2f,%u,%.2f\n", m_time / 1e9, m_nodes,
+            (unsigned long long) m_routes[0], (unsigned long long) m_routes[1], (unsigned long long) m_routes[2],
+            double (routes) / m_nodes, m_maxRoutes, double (m_neighbors) / m_nodes);
+  }
+  int64_t m_time;
+  uint32_t m_nodes;
+  /// Routes by flag: valid, invalid, in search, unknown
+  uint64_t m_routes[4];
+  uint32_t m_maxRoutes;
+  uint64_t m_neighbors;
+};
+
+int
+main (int argc, char **argv)
+{
+  std::string mode = argc == 3 ? argv[1] : "summary";
+  if ((argc != 2 && argc != 3) || (mode != "summary" && mode != "routes" && mode != "neighbors"))
+    {
+      fprintf (stderr, "Usage: %s [summary|routes|neighbors] snapshot-file\n", argv[0]);
+      return 2;
+    }
+  std::ifstream is (argv[argc - 1], std::ios::in | std::ios::binary);
+  if (!is)
+    {
+      fprintf (stderr, "Cannot open %s\n", argv[argc - 1]);
+      return 1;
+    }
+  if (mode == "summary")
+    printf ("time_s,nodes,routes_up,routes_down,routes_in_search,routes_per_node,max_routes,neighbors_per_node\n");
+  else if (mode == "routes")
+    printf ("time_s,node,address,destination,next_hop,interface,seqno,valid_seqno,lifetime_s,hops,flag,unidirectional,precursors\n");
+  else
+    printf ("time_s,node,address,neighbor,weight,status,indicator,associated_core,expire_s,hello_counter,bn_neighbors,close,client,mac_known\n");
+
+  SnapshotReader reader (is);
+  Snapshot s;
+  Summary summary;
+  uint64_t records = 0;
+  SnapshotReader::Status status;
+  while ((status = reader.Next (s)) == SnapshotReader::OK)
+    {
+      records++;
+      double time = s.m_time / 1e9;
+      std::string address = Address (s.m_address);
+      if (mode == "summary")
+        {
+          // Records of one snapshot share its time
+          if (summary.m_nodes > 0 && summary.m_time != s.m_time)
+            {
+              summary.Print ();
+              summary = Summary ();
+            }
+          summary.Add (s);
+        }
+      else if (mode == "routes")
+        {
+          for (std::vector<SnapshotRoute>::const_iterator i = s.m_routes.begin (); i != s.m_routes.end (); ++i)
+            printf ("%.3f,%u,%s,%s,%s,%s,%u,%d,%.3f,%u,%s,%d,%u\n", time, s.m_node, address.c_str (),
+                    Address (i->m_dst).c_str (), Address (i->m_nextHop).c_str (), Address (i->m_interface).c_str (),
+                    i->m_seqNo, (i->m_bits & SnapshotRoute::VALID_SEQNO) != 0, i->m_lifeTime / 1e9, i->m_hops,
+                    Flag (i->m_flag), (i->m_bits & SnapshotRoute::UNIDIRECTIONAL) != 0, i->m_precursors);
+        }
+      else
+        {
+          for (std::vector<SnapshotNeighbor>::const_iterator i = s.m_neighbors.begin (); i != s.m_neighbors.end (); ++i)
+            printf ("%.3f,%u,%s,%s,%u,%s,%u,%s,%.3f,%u,%u,%d,%d,%d\n", time, s.m_node, address.c_str (),
+                    Address (i->m_address).c_str (), i->m_weight, Status (i->m_status), i->m_indicator,
+                    Address (i->m_associatedCore).c_str (), i->m_expireTime / 1e9, i->m_helloCounter,
+                    i->m_bnNeighbors, (i->m_bits & SnapshotNeighbor::CLOSE) != 0,
+                    (i->m_bits & SnapshotNeighbor::CLIENT) != 0, (i->m_bits & SnapshotNeighbor::HARDWARE_ADDRESS) != 0);
+        }
+    }
+  if (mode == "summary" && summary.m_nodes > 0)
+    summary.Print ();
+  if (status == SnapshotReader::CORRUPT)
+    {
+      fprintf (stderr, "Corrupt or truncated record after %llu records\n", (unsigned long long) records);
+      return 1;
+    }
+  return 0;
+}